@@ -5,25 +5,52 @@
 #include "SignalProcessor.h"
 #include "FloatArray.h"
 #include "SimpleArray.h"
+#include "DelayStorage.h"
+#include "FadeRamp.h"
+#include "InterpolatedRead.h"
+#include <type_traits>
 
-class AllpassNetwork : public SignalProcessor 
+// StorageType is the sample type the delay lines are kept in, see DelayStorage.h
+template<typename StorageType>
+class AllpassNetworkTemplate : public SignalProcessor 
 {
+  using Storage = DelayStorage<StorageType>;
+
+  // number of samples the block process works on at once,
+  // which is how many dry samples we need to keep around on the stack.
+  static constexpr size_t kBlockChunk = 128;
+
+  // number of samples the block process crossfades over when the active stage count changes
+  static constexpr size_t kStageFadeLength = 256;
+
+  // each delay line is padded out to a power of two so that we can wrap with a mask.
+  // bufPos is the write position, the allpass reads from bufLen samples behind it.
   struct DelayLine
   {
-    float* buf;
+    StorageType* buf;
     size_t bufPos;
     size_t bufLen;
+    size_t bufMask;
   };
 
-  FloatArray buffer;
+  StorageType* buffer;
   SimpleArray<DelayLine> delays;
   float coeff;
   float amount;
+  // only the first activeStages delays are processed,
+  // while fading the output moves from what fadeStages stages produce to what activeStages produce.
+  size_t activeStages;
+  size_t fadeStages;
+  size_t fadeRemaining;
+  FadeRamp* fade;
+  bool ownsBuffer;
 
-  AllpassNetwork(float* bufferData, size_t bufferSize, DelayLine* delayData, size_t apSize, float diffusion)
-    : buffer(bufferData, bufferSize)
+  AllpassNetworkTemplate(StorageType* bufferData, DelayLine* delayData, size_t apSize, float diffusion)
+    : buffer(bufferData)
     , delays(delayData, apSize)
     , coeff(diffusion), amount(0)
+    , activeStages(apSize), fadeStages(apSize), fadeRemaining(0)
+    , fade(FadeRamp::create(kStageFadeLength, kStageFadeLength)), ownsBuffer(false)
   {
 
   }
@@ -39,71 +66,263 @@ public:
     coeff = diffusion;
   }
 
+  size_t getDelayLength(int api) const
+  {
+    return delays[api].bufLen;
+  }
+
+  size_t getActiveStages() const
+  {
+    return activeStages;
+  }
+
+  // run only the first count stages, the block process crossfades to the new output
+  // so that this can be changed while running. stages that are switched back on start from silence.
+  void setActiveStages(size_t count)
+  {
+    if (count > (size_t)delays.getSize())
+    {
+      count = delays.getSize();
+    }
+    if (count == activeStages)
+    {
+      return;
+    }
+    const size_t running = fadeRemaining && fadeStages > activeStages ? fadeStages : activeStages;
+    for (size_t i = running; i < count; ++i)
+    {
+      DelayLine& d = delays[i];
+      memset(d.buf, 0, (d.bufMask + 1) * sizeof(StorageType));
+      d.bufPos = 0;
+    }
+    fadeStages = activeStages;
+    activeStages = count;
+    fadeRemaining = kStageFadeLength;
+  }
+
+  // offset is in samples behind the write position and should be in the range [1, delay length],
+  // leaving room for the taps the interpolation reads either side of it.
+  template<InterpolationQuality quality = InterpolationQuality::Linear>
   float read(int api, float offset)
   {
-    DelayLine& d = delays[api];
-    int lidx = (int)offset;
-    int hidx = lidx + 1;
-    float t = offset - lidx;
-    // wrap in the buffer
-    lidx = (d.bufPos - lidx + d.bufLen) % d.bufLen;
-    hidx = (d.bufPos - hidx + d.bufLen) % d.bufLen;
-    return d.buf[lidx] + t * (d.buf[hidx] - d.buf[lidx]);
+    const DelayLine& d = delays[api];
+    return InterpolatedRead<quality, StorageType>::behind(d.buf, d.bufMask, d.bufPos, offset);
   }
 
   void write(int api, int offset, float v)
   {
     DelayLine& d = delays[api];
-    int widx = (d.bufPos - offset + d.bufLen) % d.bufLen;
-    d.buf[widx] = v;
+    d.buf[(d.bufPos - offset) & d.bufMask] = Storage::store(v);
   }
 
+  // switches stage count immediately, only the block process crossfades
   float process(float input) override
   {
     float output = input;
-    for (int i = 0; i < delays.getSize(); ++i)
+    fadeRemaining = 0;
+    for (size_t i = 0; i < activeStages; ++i)
     {
       DelayLine& d = delays[i];
-      float y = d.buf[d.bufPos];
+      float y = Storage::load(d.buf[(d.bufPos - d.bufLen) & d.bufMask]);
       float z = coeff * y + output;
-      d.buf[d.bufPos] = z;
+      d.buf[d.bufPos] = Storage::store(z);
       output = y - coeff * z;
-      d.bufPos = (d.bufPos + 1) % d.bufLen;
+      d.bufPos = (d.bufPos + 1) & d.bufMask;
     }
     return input + amount * (output - input);
   }
 
+  // runs the whole block through each stage before moving on to the next,
+  // input and output are allowed to be the same array.
+  void process(FloatArray input, FloatArray output) override
+  {
+    const float* in = input.getData();
+    float* out = output.getData();
+    size_t size = input.getSize();
+    float dry[kBlockChunk];
+    while (size)
+    {
+      const size_t len = size < kBlockChunk ? size : kBlockChunk;
+      memcpy(dry, in, len * sizeof(float));
+      if (out != in)
+      {
+        memcpy(out, dry, len * sizeof(float));
+      }
+      if (fadeRemaining)
+      {
+        processFade(out, len);
+      }
+      else
+      {
+        for (size_t i = 0; i < activeStages; ++i)
+        {
+          processStage(delays[i], out, len);
+        }
+      }
+      for (size_t i = 0; i < len; ++i)
+      {
+        out[i] = dry[i] + amount * (out[i] - dry[i]);
+      }
+      in += len;
+      out += len;
+      size -= len;
+    }
+  }
+
+private:
+  // runs every stage either stage count needs, keeping the output of the shorter chain to fade with
+  void processFade(float* inOut, size_t len)
+  {
+    const bool growing = activeStages > fadeStages;
+    const size_t lo = growing ? fadeStages : activeStages;
+    const size_t hi = growing ? activeStages : fadeStages;
+    for (size_t i = 0; i < lo; ++i)
+    {
+      processStage(delays[i], inOut, len);
+    }
+    float shorter[kBlockChunk];
+    memcpy(shorter, inOut, len * sizeof(float));
+    for (size_t i = lo; i < hi; ++i)
+    {
+      processStage(delays[i], inOut, len);
+    }
+    const size_t pos = kStageFadeLength - fadeRemaining;
+    if (growing)
+    {
+      fade->crossfade(shorter, inOut, inOut, pos, len);
+    }
+    else
+    {
+      fade->crossfade(inOut, shorter, inOut, pos, len);
+    }
+    fadeRemaining = fadeRemaining > len ? fadeRemaining - len : 0;
+  }
+
+  void processStage(DelayLine& d, float* inOut, size_t len)
+  {
+    const size_t bufSize = d.bufMask + 1;
+    size_t w = d.bufPos;
+    size_t r = (w - d.bufLen) & d.bufMask;
+    while (len)
+    {
+      // largest span where neither the read nor the write position wraps
+      size_t span = bufSize - (w > r ? w : r);
+      if (span > len)
+      {
+        span = len;
+      }
+      StorageType* wp = d.buf + w;
+      const StorageType* rp = d.buf + r;
+      if constexpr (std::is_same<StorageType, float>::value)
+      {
+        for (size_t i = 0; i < span; ++i)
+        {
+          float y = rp[i];
+          float z = coeff * y + inOut[i];
+          wp[i] = z;
+          inOut[i] = y - coeff * z;
+        }
+      }
+      else
+      {
+        // convert the span we read to float and the span we write back in bulk,
+        // which means the span can't be long enough to read anything it writes.
+        if (span > kBlockChunk)
+        {
+          span = kBlockChunk;
+        }
+        if (span > d.bufLen)
+        {
+          span = d.bufLen;
+        }
+        float y[kBlockChunk];
+        Storage::loadBlock(rp, y, span);
+        for (size_t i = 0; i < span; ++i)
+        {
+          float z = coeff * y[i] + inOut[i];
+          inOut[i] = y[i] - coeff * z;
+          y[i] = z;
+        }
+        Storage::storeBlock(y, wp, span);
+      }
+      inOut += span;
+      len -= span;
+      w = (w + span) & d.bufMask;
+      r = (r + span) & d.bufMask;
+    }
+    d.bufPos = w;
+  }
+
+public:
   using SignalProcessor::process;
 
-  static AllpassNetwork* create(size_t* delayLengths, size_t delayCount, float diffusion)
+  // smallest power of two that can hold a delay of len samples plus the sample being written
+  static size_t getPaddedLength(size_t len)
+  {
+    size_t padded = 1;
+    while (padded <= len)
+    {
+      padded <<= 1;
+    }
+    return padded;
+  }
+
+  // how many samples of buffer memory a network with these delay lengths needs
+  static size_t getBufferSize(const size_t* delayLengths, size_t delayCount)
   {
-    DelayLine* delayData = new DelayLine[delayCount];
     size_t bufferSize = 0;
     for (int i = 0; i < delayCount; ++i)
     {
-      bufferSize += delayLengths[i];
+      bufferSize += getPaddedLength(delayLengths[i]);
     }
-    float* bufferData = new float[bufferSize];
-    memset(bufferData, 0, sizeof(float)*bufferSize);
-    float* head = bufferData;
+    return bufferSize;
+  }
+
+  static AllpassNetworkTemplate* create(const size_t* delayLengths, size_t delayCount, float diffusion)
+  {
+    size_t bufferSize = getBufferSize(delayLengths, delayCount);
+    StorageType* bufferData = new StorageType[bufferSize];
+    memset(bufferData, 0, sizeof(StorageType)*bufferSize);
+    AllpassNetworkTemplate* network = create(delayLengths, delayCount, diffusion, bufferData);
+    network->ownsBuffer = true;
+    return network;
+  }
+
+  // create a network whose delay lines live in memory owned by the caller,
+  // which must be at least getBufferSize samples long and cleared.
+  static AllpassNetworkTemplate* create(const size_t* delayLengths, size_t delayCount, float diffusion, StorageType* bufferData)
+  {
+    DelayLine* delayData = new DelayLine[delayCount];
+    StorageType* head = bufferData;
     for (int i = 0; i < delayCount; ++i)
     {
-      int len = delayLengths[i];
+      size_t len = getPaddedLength(delayLengths[i]);
       DelayLine& ap = delayData[i];
       ap.bufPos = 0;
-      ap.bufLen = len;
+      ap.bufLen = delayLengths[i];
+      ap.bufMask = len - 1;
       ap.buf = head;
       head = head + len;
     }
-    return new AllpassNetwork(bufferData, bufferSize, delayData, delayCount, diffusion);
+    return new AllpassNetworkTemplate(bufferData, delayData, delayCount, diffusion);
   }
 
-  static void destroy(AllpassNetwork* network)
+  static void destroy(AllpassNetworkTemplate* network)
   {
-    delete[] network->buffer.getData();
+    if (network->ownsBuffer)
+    {
+      delete[] network->buffer;
+    }
     delete[] network->delays.getData();
+    FadeRamp::destroy(network->fade);
     delete network;
   }
 };
 
+typedef AllpassNetworkTemplate<float> AllpassNetwork;
+typedef AllpassNetworkTemplate<int16_t> ShortAllpassNetwork;
+#ifdef DELAY_STORAGE_HALF
+typedef AllpassNetworkTemplate<Half> HalfAllpassNetwork;
+#endif
+
 #endif // __ALLPASS_NETWORK_H__
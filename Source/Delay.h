@@ -5,6 +5,7 @@
 #include "CrossFadingCircularBuffer.h"
 #include "InterpolatingCircularBuffer.h"
 #include "FractionalCircularBuffer.h"
+#include "FadeRamp.h"
 
 template<class BufferType>
 class DelayProcessor : SignalProcessor
@@ -36,6 +37,42 @@ public:
     buffer->setDelay(delaySamples);
   }
 
+  // delays every sample by its own time in samples, for modulating the delay at audio rate.
+  // the whole input block is written before reading, so delay times should be in [0, buffer size - block size].
+  // input and output may be the same array. the last delay time becomes the delay for the other process methods.
+  void processModulated(FloatArray input, FloatArray output, FloatArray delayTimes)
+  {
+    const size_t len = input.getSize();
+    const size_t size = buffer->getSize();
+    size_t head = buffer->getWriteIndex();
+    buffer->write(input.getData(), len);
+
+    const float* data = buffer->getData();
+    const float* delay = delayTimes.getData();
+    float* out = output.getData();
+    size_t n = 0;
+    while (n < len)
+    {
+      // span where the write position doesn't wrap, so a read position never needs more than one wrap back
+      const size_t span = min(len - n, size - head);
+      for (size_t i = 0; i < span; ++i)
+      {
+        const float d = delay[n + i];
+        const size_t di = (size_t)d;
+        const float t = d - di;
+        size_t r = head + i + size - di;
+        r = r >= size ? r - size : r;
+        const size_t r1 = r == 0 ? size - 1 : r - 1;
+        out[n + i] = data[r] + t * (data[r1] - data[r]);
+      }
+      n += span;
+      head = 0;
+    }
+
+    delaySamples = delay[len - 1];
+    buffer->setDelay(delaySamples);
+  }
+
   static DelayProcessor* create(size_t maxDelayLength, size_t blockSize)
   {
     return new DelayProcessor(BufferType::create(maxDelayLength));
@@ -66,15 +103,16 @@ private:
   using DelayProcessor<BufferType>::delaySamples;
 
   bool freeze;
+  // samples left to read before the frozen loop restarts, out of loopLength
   int freezeRead;
+  int loopLength;
   int pos;
-  float fade;
-  float fadeInc;
-  int   fadeLen;
+  // fades each pass of the loop in and out
+  FadeRamp* fade;
 
 public:
-  DelayWithFreezeProcessor(BufferType* buffer)
-    : DelayProcessor<BufferType>(buffer), freeze(false), pos(0), fade(0), fadeInc(0), fadeLen(0)
+  DelayWithFreezeProcessor(BufferType* buffer, FadeRamp* fade)
+    : DelayProcessor<BufferType>(buffer), freeze(false), loopLength(0), pos(0), fade(fade)
   {
 
   }
@@ -95,6 +133,12 @@ public:
     return pos;
   }
 
+  // equal power fades keep the loop from dipping in level around restarts when it is short
+  void setEqualPowerFade(bool enabled)
+  {
+    fade->setEqualPower(enabled);
+  }
+
   void process(FloatArray input, FloatArray output) override
   {
     if (freeze)
@@ -133,44 +177,28 @@ public:
   }
 
 private:
+  // called with freezeRead set to the length of the loop that is starting
   void beginFade(int blockSize)
   {
-    fade = 0.0f;
-    fadeLen = min((float)blockSize, max(delaySamples / 8, 1.0f));
-    fadeInc = 1.0f / fadeLen;
+    loopLength = freezeRead;
+    fade->setLength(min((float)blockSize, max(delaySamples / 8, 1.0f)));
   }
 
+  // freezeRead is still how much of the loop was left before these len samples
   void processFade(float* buffer, int len)
   {
-    int remaining = freezeRead;
-    while(len--)
-    {
-      *buffer++ = *buffer * fade;
-      remaining--;
-      if (fadeInc != 0)
-      {
-        fade += fadeInc;
-        if (fade <= 0 || fade >= 1)
-        {
-          fadeInc = 0;
-          fade = clamp(fade, 0.0f, 1.0f);
-        }
-      }
-      else if (remaining <= fadeLen)
-      {
-        fadeInc = -1.0f / fadeLen;
-      }
-    }
+    fade->applyWindow(buffer, loopLength - freezeRead, len, loopLength);
   }
 
 public:
   static DelayWithFreezeProcessor* create(size_t maxDelayLength, size_t blockSize)
   {
-    return new DelayWithFreezeProcessor(BufferType::create(maxDelayLength));
+    return new DelayWithFreezeProcessor(BufferType::create(maxDelayLength), FadeRamp::create(blockSize, blockSize));
   }
 
   static void destroy(DelayWithFreezeProcessor* obj)
   {
+    FadeRamp::destroy(obj->fade);
     DelayProcessor<BufferType>::destroy(obj);
   }
 };
@@ -182,5 +210,5 @@ typedef DelayWithFreezeProcessor<FractionalCircularFloatBuffer> FractionalDelayW
 template<>
 CrossFadingDelayWithFreezeProcessor* CrossFadingDelayWithFreezeProcessor::create(size_t maxDelayLength, size_t blockSize)
 {
-  return new CrossFadingDelayWithFreezeProcessor(CrossFadingCircularFloatBuffer::create(maxDelayLength, blockSize));
+  return new CrossFadingDelayWithFreezeProcessor(CrossFadingCircularFloatBuffer::create(maxDelayLength, blockSize), FadeRamp::create(blockSize, blockSize));
 }
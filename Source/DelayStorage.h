@@ -0,0 +1,213 @@
+#pragma once
+#ifndef __DELAY_STORAGE_H__
+#define __DELAY_STORAGE_H__
+
+// Conversions between float and the sample types delay memory can be stored as.
+// Reverb tails don't need 32 bits of precision, so storing them in 16 bits halves the memory,
+// which can be enough to move the delay lines out of SDRAM and into the much faster internal SRAM.
+// Single samples are converted with load/store, spans are converted in bulk with loadBlock/storeBlock.
+
+#include <stdint.h>
+#include <string.h>
+
+// IEEE half precision float, only declared when DELAY_STORAGE_HALF is defined before this is included,
+// so patches that don't store delays as halves never touch __fp16.
+// The Cortex-M7 FPU converts these to and from single precision in one instruction,
+// but only when the compiler is given -mfp16-format=ieee, without it or elsewhere we convert in software.
+#ifdef DELAY_STORAGE_HALF
+#if defined(ARM_CORTEX) && defined(__ARM_FP16_FORMAT_IEEE)
+#define DELAY_STORAGE_NATIVE_HALF
+typedef __fp16 Half;
+#else
+struct Half
+{
+  uint16_t bits;
+};
+#endif
+#endif // DELAY_STORAGE_HALF
+
+template<typename StorageType>
+struct DelayStorage;
+
+template<>
+struct DelayStorage<float>
+{
+  static inline float load(float v) { return v; }
+  static inline float store(float v) { return v; }
+
+  static void loadBlock(const float* src, float* dst, size_t len)
+  {
+    memcpy(dst, src, len * sizeof(float));
+  }
+
+  static void storeBlock(const float* src, float* dst, size_t len)
+  {
+    memcpy(dst, src, len * sizeof(float));
+  }
+};
+
+// fixed point with 2 bits of headroom, about 14 bits of resolution below full scale.
+// The headroom is for the state inside an allpass, coeff * y + x, which can reach 1 / (1 - coeff) times the input,
+// 2.7 at the 0.625 diffusion the reverbs default to, and up to 4 with diffusion at 0.75.
+template<>
+struct DelayStorage<int16_t>
+{
+  static constexpr float kToShort = 8192.0f;
+  static constexpr float kToFloat = 1.0f / 8192.0f;
+
+  static inline float load(int16_t v) { return v * kToFloat; }
+
+  // rounded to nearest so the error has no bias for recirculating tails to build up,
+  // except within a few steps of zero, where rounding would let a decaying allpass settle into a limit cycle
+  // of one or two steps that never reaches silence, so quiet samples are truncated towards zero instead.
+  // clamped before converting, which the compiler turns into min and max on the Cortex-M7
+  static constexpr float kTruncateBelow = 4.0f;
+
+  static inline int16_t store(float v)
+  {
+    float s = v * kToShort;
+    s = s < -32768.0f ? -32768.0f : s > 32767.0f ? 32767.0f : s;
+    s += s >= kTruncateBelow ? 0.5f : s <= -kTruncateBelow ? -0.5f : 0.0f;
+    return (int16_t)(int32_t)s;
+  }
+
+  // written as plain loops over restrict pointers so they vectorize where there is float SIMD
+  static void loadBlock(const int16_t* __restrict src, float* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = src[i] * kToFloat;
+    }
+  }
+
+  static void storeBlock(const float* __restrict src, int16_t* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = store(src[i]);
+    }
+  }
+};
+
+// fixed point using the whole 16 bits, for recordings that never go past 1, like the Grainz record buffer.
+// A separate type rather than a different scale for int16_t, so a buffer can't be read back with the wrong one.
+struct FullScaleShort
+{
+  int16_t value;
+};
+
+template<>
+struct DelayStorage<FullScaleShort>
+{
+  static constexpr float kToShort = 32767.0f;
+  static constexpr float kToFloat = 1.0f / 32767.0f;
+
+  static inline float load(FullScaleShort v) { return v.value * kToFloat; }
+
+  // rounded to nearest, anything past full scale is clamped, so soft clip the signal first if it can get there
+  static inline FullScaleShort store(float v)
+  {
+    float s = v * kToShort;
+    s = s < -32767.0f ? -32767.0f : s > 32767.0f ? 32767.0f : s;
+    s += s < 0 ? -0.5f : 0.5f;
+    return { (int16_t)(int32_t)s };
+  }
+
+  static void loadBlock(const FullScaleShort* __restrict src, float* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = src[i].value * kToFloat;
+    }
+  }
+
+  static void storeBlock(const float* __restrict src, FullScaleShort* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = store(src[i]);
+    }
+  }
+};
+
+#ifdef DELAY_STORAGE_HALF
+template<>
+struct DelayStorage<Half>
+{
+#ifdef DELAY_STORAGE_NATIVE_HALF
+  static inline float load(Half v) { return (float)v; }
+  static inline Half store(float v) { return (Half)v; }
+#else
+  static inline float load(Half v)
+  {
+    const uint32_t sign = (uint32_t)(v.bits & 0x8000) << 16;
+    const uint32_t exponent = (v.bits >> 10) & 0x1f;
+    const uint32_t mantissa = v.bits & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0)
+    {
+      // flush denormals, they are far below anything audible
+      bits = sign;
+    }
+    else if (exponent == 0x1f)
+    {
+      bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+  }
+
+  static inline Half store(float v)
+  {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(float));
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 112;
+    // round to nearest by adding half of the dropped mantissa bits
+    const uint32_t mantissa = (bits & 0x7fffff) + 0x1000;
+    Half h;
+    if (exponent <= 0)
+    {
+      h.bits = sign;
+    }
+    else if (mantissa & 0x800000)
+    {
+      // rounding carried into the exponent
+      h.bits = exponent + 1 >= 0x1f ? sign | 0x7c00 : sign | ((exponent + 1) << 10);
+    }
+    else if (exponent >= 0x1f)
+    {
+      h.bits = sign | 0x7c00;
+    }
+    else
+    {
+      h.bits = sign | (exponent << 10) | (mantissa >> 13);
+    }
+    return h;
+  }
+#endif
+
+  static void loadBlock(const Half* __restrict src, float* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = load(src[i]);
+    }
+  }
+
+  static void storeBlock(const float* __restrict src, Half* __restrict dst, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+    {
+      dst[i] = store(src[i]);
+    }
+  }
+};
+#endif // DELAY_STORAGE_HALF
+
+#endif // __DELAY_STORAGE_H__
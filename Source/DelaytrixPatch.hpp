@@ -4,6 +4,7 @@
 #include "MonochromeScreenPatch.h"
 #include "vessicle/DelayMatrix.h"
 #include "vessicle/Noise.hpp"
+#include "ParameterCache.h"
 
 // for building param names
 #include <cstring>
@@ -12,44 +13,46 @@
 inline char * stpcpy(char *s1, const char *s2) { return strcat(s1, s2); }  // NOLINT(clang-diagnostic-deprecated-declarations)
 #endif
 
-enum : uint8_t
-{
-  DELAY_COUNT = 4
-};
-
+// inputs are mirrored so that the delay matrix is only updated with the ones that moved
 struct DelaytrixParamIds
 {
-  PatchParameterId time;
-  PatchParameterId spread;
-  PatchParameterId feedback;
-  PatchParameterId dryWet;
-  PatchParameterId skew;
+  ParameterMirror time;
+  ParameterMirror spread;
+  ParameterMirror feedback;
+  ParameterMirror dryWet;
+  ParameterMirror skew;
   PatchParameterId lfoOut;
   PatchParameterId rndOut;
-  PatchParameterId modIndex;
+  ParameterMirror modIndex;
 };
 
-class DelaytrixPatch : public MonochromeScreenPatch
+// There are only enough parameters for four lines of controls, so the matrix can have at most four lines.
+// Every line has its own input, color and feedback controls and its own row on the screen.
+template<uint8_t lineCount>
+class DelaytrixPatchTemplate : public MonochromeScreenPatch
 {
+  static_assert(lineCount > 0 && lineCount <= 4, "Delaytrix only has parameters for up to four lines");
+
   struct DelayLineParamIds
   {
-    PatchParameterId input;    // amount of input fed into the delay
-    PatchParameterId cutoff;   // cutoff for the filter
-    PatchParameterId feedback[DELAY_COUNT];     // amount of wet signal sent to other delays
+    ParameterMirror input;    // amount of input fed into the delay
+    ParameterMirror cutoff;   // cutoff for the filter
+    ParameterMirror feedback[lineCount];     // amount of wet signal sent to other delays
   };
   
-  using Delaytrix = DelayMatrix<DELAY_COUNT>;
-  using FreezeState = Delaytrix::FreezeState;
-  using Tap = Delaytrix::TapDelayLength;
+  using Delaytrix = DelayMatrix<lineCount>;
+  using FreezeState = typename Delaytrix::FreezeState;
+  using Tap = typename Delaytrix::TapDelayLength;
+  using DelayLineData = typename Delaytrix::DelayLineData;
   
   DelaytrixParamIds patchParams;
-  DelayLineParamIds delayParams[DELAY_COUNT];
+  DelayLineParamIds delayParams[lineCount];
   
   Delaytrix delayMatrix;
   float dryWetAnim = 0;
 
 public:
-  DelaytrixPatch() 
+  DelaytrixPatchTemplate() 
   : patchParams({ PARAMETER_A, PARAMETER_C, PARAMETER_B, PARAMETER_D, PARAMETER_E, PARAMETER_F, PARAMETER_G, PARAMETER_H })
   , delayMatrix(getSampleRate(), getBlockSize())
   {
@@ -65,7 +68,7 @@ public:
     setParameterValue(patchParams.modIndex, 0.5f);
     
     char pname[16];
-    for (int i = 0; i < DELAY_COUNT; ++i)
+    for (int i = 0; i < lineCount; ++i)
     {
       DelayLineParamIds& params = delayParams[i];
       params.input = static_cast<PatchParameterId>(PARAMETER_AA + i);
@@ -80,7 +83,7 @@ public:
       registerParameter(params.cutoff, pname);
       setParameterValue(params.cutoff, 0.99f);
 
-      for (int f = 0; f < DELAY_COUNT; ++f)
+      for (int f = 0; f < lineCount; ++f)
       {
         params.feedback[f] = static_cast<PatchParameterId>(PARAMETER_BA + f * 4 + i);
         p = stpcpy(pname, "Fdbk ");
@@ -92,28 +95,31 @@ public:
         // when the global feedback param is turned up
         if (i == f) { setParameterValue(params.feedback[f], 0.99f); }
         else { setParameterValue(params.feedback[f], 0.5f); }
+        params.feedback[f].seed(this);
       }
+      params.input.seed(this);
+      params.cutoff.seed(this);
     }
   }
   
   void processAudio(AudioBuffer& audio) override
   {
-    delayMatrix.time() = getParameterValue(patchParams.time);
-    delayMatrix.spread() = getParameterValue(patchParams.spread);
-    delayMatrix.feedback() = getParameterValue(patchParams.feedback);
-    delayMatrix.dryWet() = getParameterValue(patchParams.dryWet);
-    delayMatrix.skew() = getParameterValue(patchParams.skew);
-    delayMatrix.mod() = getParameterValue(patchParams.modIndex);
+    patchParams.time.update(this, delayMatrix.time());
+    patchParams.spread.update(this, delayMatrix.spread());
+    patchParams.feedback.update(this, delayMatrix.feedback());
+    patchParams.dryWet.update(this, delayMatrix.dryWet());
+    patchParams.skew.update(this, delayMatrix.skew());
+    patchParams.modIndex.update(this, delayMatrix.mod());
     
-    for (int i = 0; i < DELAY_COUNT; ++i)
+    for (int i = 0; i < lineCount; ++i)
     {
       auto& dlp = delayParams[i];
       auto& delay = delayMatrix.delay(i);
-      delay.input.value = getParameterValue(dlp.input);
-      delay.cutoff.value = getParameterValue(dlp.cutoff);
-      for (int f = 0; f < DELAY_COUNT; ++f)
+      dlp.input.update(this, delay.input.value);
+      dlp.cutoff.update(this, delay.cutoff.value);
+      for (int f = 0; f < lineCount; ++f)
       {
-        delay.feedback[f].value = getParameterValue(dlp.feedback[f]);
+        dlp.feedback[f].update(this, delay.feedback[f].value);
       }
     }
     
@@ -128,7 +134,7 @@ public:
     
     setButton(PUSHBUTTON, delayMatrix.gate().read_binary());
     
-    FreezeState freezeState = delayMatrix.freeze().read<FreezeState>();
+    FreezeState freezeState = delayMatrix.freeze().template read<FreezeState>();
     setButton(BUTTON_2, freezeState == FreezeState::On ? 1 : 0);
     // this is the second gate output on the Witch
     setButton(BUTTON_6, freezeState == FreezeState::On ? 1 : 0);
@@ -152,260 +158,105 @@ public:
   
   void processScreen(MonochromeScreenBuffer& screen) override 
   {
-    screen.clear();
-
-    constexpr uint16_t matrixTop = 17;
-    constexpr uint16_t knobRadius = 4;
-    uint16_t x = 0;
-
-    constexpr uint16_t headingY = matrixTop - knobRadius * 2 - 1;
-    screen.setCursor(x, headingY);
-    if (delayMatrix.isClocked())
-    {
-      screen.print("Q=");
-      screen.print(static_cast<int>(delayMatrix.bpm()));
-    }
-    else
+    // the screen keeps what was drawn on it last frame, so only the regions whose values changed are redrawn,
+    // unless we have been given a different buffer to draw into.
+    const bool redrawAll = screen.getBuffer() != lastScreen;
+    lastScreen = screen.getBuffer();
+    if (redrawAll)
     {
-      screen.print("TIME");
+      screen.clear();
     }
-    x += 39;
-    screen.setCursor(x, headingY);
-    screen.print("IN");
-    x += 14;
-    screen.setCursor(x, headingY);
-    screen.print("LP");
-    x += 14;
 
-    const Delaytrix::DelayLineData& lastData = delayMatrix.getDelayData(DELAY_COUNT - 1);
-    FreezeState freezeState = delayMatrix.freeze().read<FreezeState>();
+    const DelayLineData& lastData = delayMatrix.getDelayData(lineCount - 1);
+    const FreezeState freezeState = delayMatrix.freeze().template read<FreezeState>();
+    const bool frozen = freezeState == FreezeState::On;
     float lastTime = lastData.time.value;
     const float lastMaxFreezePosition = vessl::math::min(lastTime * 8 - lastTime - lastData.skew, static_cast<float>(lastData.delayLength) - lastTime - lastData.skew);
     const float maxFreezeSize = lastMaxFreezePosition + lastTime + lastData.skew;
-    if (freezeState == FreezeState::On)
-    {
-      screen.setCursor(x, headingY);
-      screen.print("/");
-      screen.print(ftoa(maxFreezeSize / getSampleRate(), 10));
-      screen.print("s\\");
-    }
 
-    for (uint16_t i = 0; i < DELAY_COUNT; ++i)
+    HeadingState heading = {};
+    heading.clocked = delayMatrix.isClocked();
+    heading.bpm = heading.clocked ? static_cast<int32_t>(delayMatrix.bpm()) : 0;
+    heading.frozen = frozen;
+    heading.freezeMillis = frozen ? static_cast<int32_t>(maxFreezeSize * 1000 / getSampleRate()) : 0;
+    const bool headingChanged = refresh(headingState, heading);
+
+    for (uint16_t i = 0; i < lineCount; ++i)
     {
-      constexpr uint16_t rowSpacing = 12;
-      const Delaytrix::DelayLineData& data = delayMatrix.getDelayData(i);
-      uint16_t rowY = matrixTop + rowSpacing * i;
-      uint16_t knobY = rowY - knobRadius - 1;
-      x = 1;
-      if (delayMatrix.isClocked())
+      const DelayLineData& data = delayMatrix.getDelayData(i);
+      RowState row = {};
+      row.clocked = heading.clocked;
+      row.label = heading.clocked ? tapFor(i) : static_cast<int32_t>(data.time.value * 1000 / getSampleRate());
+      row.input = quantize(data.input.value);
+      row.cutoff = quantize((data.cutoff.value - Delaytrix::MIN_CUTOFF) / (Delaytrix::MAX_CUTOFF - Delaytrix::MIN_CUTOFF));
+      row.frozen = frozen;
+      if (frozen)
       {
-        int clockMult = delayMatrix.clockMult();
-        int spreadDivMult = delayMatrix.spreadMult();
-        int tapFirst = Tap::Quarter / clockMult;
-        int spreadInc = spreadDivMult < 0 ? tapFirst / -spreadDivMult : tapFirst * spreadDivMult;
-        Tap tap = static_cast<Tap>(tapFirst + spreadInc * i);
-        screen.setCursor(x, rowY);
-        switch (tap)  // NOLINT(clang-diagnostic-switch-enum)
-        {
-          // for easy debug
-          case 0: screen.print(ftoa(data.time.value / getSampleRate(), 10)); break;
-#define QUAV ""
-#define DOT2 "."
-#define DOT4 ","
-#define DOT8 ";"
-          case Tap::Whole: screen.print("W"); break;
-          case Tap::Half: screen.print("H"); break;
-          case Tap::Quarter: screen.print("Q"); break;
-          case Tap::One8: screen.print(QUAV "8"); break;
-          case Tap::One16: screen.print(QUAV "16"); break;
-          case Tap::One32: screen.print(QUAV "32"); break;
-          case Tap::One64: screen.print(QUAV "64"); break;
-          case Tap::One128: screen.print(QUAV "128"); break;
-          case Tap::One256: screen.print(QUAV "256"); break;
-          case Tap::One512: screen.print(QUAV "512"); break;
-
-          case Tap::WholeT: screen.print("WT"); break;
-          case Tap::HalfT: screen.print("HT"); break;
-          case Tap::QuarterT: screen.print("QT"); break;
-          case Tap::One8T: screen.print(QUAV "8T"); break;
-          case Tap::One16T: screen.print(QUAV "16T"); break;
-          case Tap::One32T: screen.print(QUAV "32T"); break;
-          case Tap::One64T: screen.print(QUAV "64T"); break;
-          case Tap::One128T: screen.print(QUAV "128T"); break;
-          case Tap::One256T: screen.print(QUAV "256T"); break;
-          case Tap::One512T: screen.print(QUAV "512T"); break;
-          case Tap::One1028T: screen.print(QUAV "1028T"); break;
-
-          case Tap::WholeTT: screen.print("WTT"); break;
-          case Tap::HalfTT: screen.print("HTT"); break;
-          case Tap::QuarterTT: screen.print("QTT"); break;
-          case Tap::One8TT: screen.print(QUAV "8TT"); break;
-          case Tap::One16TT: screen.print(QUAV "16TT"); break;
-          case Tap::One32TT: screen.print(QUAV "32TT"); break;
-          case Tap::One64TT: screen.print(QUAV "64TT"); break;
-          case Tap::One128TT: screen.print(QUAV "128TT"); break;
-          case Tap::One256TT: screen.print(QUAV "256TT"); break;
-          case Tap::One512TT: screen.print(QUAV "512TT"); break;
-          case Tap::One1028TT: screen.print(QUAV "1028TT"); break;
-
-          case Tap::Whole     + Tap::One8: screen.print("W" DOT8); break;
-          case Tap::Half      + Tap::One16: screen.print("H" DOT8); break;
-          case Tap::Quarter   + Tap::One32: screen.print("Q" DOT8); break;
-          case Tap::One8      + Tap::One64: screen.print(QUAV "8" DOT8); break;
-          case Tap::One16     + Tap::One128: screen.print(QUAV "16" DOT8); break;
-          case Tap::One32     + Tap::One256: screen.print(QUAV "32" DOT8); break;
-          case Tap::One64     + Tap::One512: screen.print(QUAV "64" DOT8); break;
-          case Tap::One128    + Tap::One1028: screen.print(QUAV "128" DOT8); break;
-
-          case Tap::Whole     + Tap::Quarter: screen.print("W" DOT4); break;
-          case Tap::Half      + Tap::One8: screen.print("H" DOT4); break;
-          case Tap::Quarter   + Tap::One16: screen.print("Q" DOT4); break;
-          case Tap::One8      + Tap::One32: screen.print(QUAV "8" DOT4); break;
-          case Tap::One16     + Tap::One64: screen.print(QUAV "16" DOT4); break;
-          case Tap::One32     + Tap::One128: screen.print(QUAV "32" DOT4); break;
-          case Tap::One64     + Tap::One256: screen.print(QUAV "64" DOT4); break;
-          case Tap::One128    + Tap::One512: screen.print(QUAV "128" DOT4); break;
-
-          case Tap::Whole     + Tap::Quarter  + Tap::One16: screen.print("W" DOT4 DOT4); break;
-          case Tap::Half      + Tap::One8     + Tap::One32: screen.print("H" DOT4 DOT4); break;
-          case Tap::Quarter   + Tap::One16    + Tap::One64: screen.print("Q" DOT4 DOT4); break;
-          case Tap::One8      + Tap::One32    + Tap::One128: screen.print(QUAV "8" DOT4 DOT4); break;
-          case Tap::One16     + Tap::One64    + Tap::One256: screen.print(QUAV "16" DOT4 DOT4); break;
-          case Tap::One32     + Tap::One128   + Tap::One512: screen.print(QUAV "32" DOT4 DOT4); break;
-          case Tap::One64     + Tap::One256   + Tap::One1028: screen.print(QUAV "64" DOT4 DOT4); break;
-
-          case Tap::WholeT    + Tap::QuarterT: screen.print("WT" DOT4); break;
-          case Tap::HalfT     + Tap::One8T: screen.print("HT" DOT4); break;
-          case Tap::QuarterT  + Tap::One16T: screen.print("QT" DOT4); break;
-          case Tap::One8T     + Tap::One32T: screen.print(QUAV "8T" DOT4); break;
-          case Tap::One16T    + Tap::One64T: screen.print(QUAV "16T" DOT4); break;
-          case Tap::One32T    + Tap::One128T: screen.print(QUAV "32T" DOT4); break;
-          case Tap::One64T    + Tap::One256T: screen.print(QUAV "64T" DOT4); break;
-          case Tap::One128T   + Tap::One512T: screen.print(QUAV "128T" DOT4); break;
-
-          case Tap::WholeTT   + Tap::QuarterTT: screen.print("WTT" DOT4); break;
-          case Tap::HalfTT    + Tap::One8TT: screen.print("HTT" DOT4); break;
-          case Tap::QuarterTT + Tap::One16TT: screen.print("QTT" DOT4); break;
-          case Tap::One8TT    + Tap::One32TT: screen.print(QUAV "8TT" DOT4); break;
-          case Tap::One16TT   + Tap::One64TT: screen.print(QUAV "16TT" DOT4); break;
-          case Tap::One32TT   + Tap::One128TT: screen.print(QUAV "32TT" DOT4); break;
-          case Tap::One64TT   + Tap::One256TT: screen.print(QUAV "64TT" DOT4); break;
-          case Tap::One128TT  + Tap::One512TT: screen.print(QUAV "128TT" DOT4); break;
-
-          case Tap::Whole     + Tap::Half: screen.print("W" DOT2); break;
-          case Tap::Half      + Tap::Quarter: screen.print("H" DOT2); break;
-          case Tap::Quarter   + Tap::One8: screen.print("Q" DOT2); break;
-          case Tap::One8      + Tap::One16: screen.print(QUAV "8" DOT2); break;
-          case Tap::One16     + Tap::One32: screen.print(QUAV "16" DOT2); break;
-          case Tap::One32     + Tap::One64: screen.print(QUAV "32" DOT2); break;
-          case Tap::One64     + Tap::One128: screen.print(QUAV "64" DOT2); break;
-          case Tap::One128    + Tap::One256: screen.print(QUAV "128" DOT2); break;
-          case Tap::One256    + Tap::One512: screen.print(QUAV "256" DOT2); break;
-
-          case Tap::Whole     + Tap::Half      + Tap::Quarter: screen.print("W" DOT2 DOT2); break;
-          case Tap::Half      + Tap::Quarter   + Tap::One8: screen.print("H" DOT2 DOT2); break;
-          case Tap::Quarter   + Tap::One8      + Tap::One16: screen.print("Q" DOT2 DOT2); break;
-          case Tap::One8      + Tap::One16     + Tap::One32: screen.print(QUAV "8" DOT2 DOT2); break;
-          case Tap::One16     + Tap::One32     + Tap::One64: screen.print(QUAV "16" DOT2 DOT2); break;
-          case Tap::One32     + Tap::One64     + Tap::One128: screen.print(QUAV "32" DOT2 DOT2); break;
-          case Tap::One64     + Tap::One128    + Tap::One256: screen.print(QUAV "64" DOT2 DOT2); break;
-          case Tap::One128    + Tap::One256    + Tap::One512: screen.print(QUAV "128" DOT2 DOT2); break;
-
-          case Tap::WholeT    + Tap::HalfT     + Tap::QuarterT: screen.print("WT" DOT2 DOT2); break;
-          case Tap::QuarterT  + Tap::One8T     + Tap::One16T: screen.print("QT" DOT2 DOT2); break;
-          case Tap::HalfT     + Tap::QuarterT  + Tap::One8T: screen.print("HT" DOT2 DOT2); break;
-          case Tap::One8T     + Tap::One16T    + Tap::One32T: screen.print(QUAV "8T"  DOT2 DOT2); break;
-          case Tap::One16T    + Tap::One32T    + Tap::One64T: screen.print(QUAV "16T" DOT2 DOT2); break;
-          case Tap::One32T    + Tap::One64T    + Tap::One128T: screen.print(QUAV "32T" DOT2 DOT2); break;
-          case Tap::One64T    + Tap::One128T   + Tap::One256T: screen.print(QUAV "64T" DOT2 DOT2); break;
-          case Tap::One128T   + Tap::One256T   + Tap::One512T: screen.print(QUAV "128T" DOT2 DOT2); break;
-
-          case Tap::WholeTT   + Tap::HalfTT    + Tap::QuarterTT: screen.print("WTT" DOT2 DOT2); break;
-          case Tap::QuarterTT + Tap::One8TT    + Tap::One16TT: screen.print("QTT" DOT2 DOT2); break;
-          case Tap::HalfTT    + Tap::QuarterTT + Tap::One8TT: screen.print("HTT" DOT2 DOT2); break;
-          case Tap::One8TT    + Tap::One16TT   + Tap::One32TT: screen.print(QUAV "8TT"  DOT2 DOT2); break;
-          case Tap::One16TT   + Tap::One32TT   + Tap::One64TT: screen.print(QUAV "16TT" DOT2 DOT2); break;
-          case Tap::One32TT   + Tap::One64TT   + Tap::One128TT: screen.print(QUAV "32TT" DOT2 DOT2); break;
-          case Tap::One64TT   + Tap::One128TT  + Tap::One256TT: screen.print(QUAV "64TT" DOT2 DOT2); break;
-          case Tap::One128TT  + Tap::One256TT  + Tap::One512TT: screen.print(QUAV "128TT" DOT2 DOT2); break;
-
-          case Tap::Whole     + Tap::Half      + Tap::One8: screen.print("W" DOT2 DOT4); break;
-          case Tap::Half      + Tap::Quarter   + Tap::One16: screen.print("H" DOT2 DOT4); break;
-          case Tap::Quarter   + Tap::One8      + Tap::One32: screen.print("Q" DOT2 DOT4); break;
-          case Tap::One8      + Tap::One16     + Tap::One64: screen.print(QUAV "8" DOT2 DOT4); break;
-          case Tap::One16     + Tap::One32     + Tap::One128: screen.print(QUAV "16" DOT2 DOT4); break;
-          case Tap::One32     + Tap::One64     + Tap::One256: screen.print(QUAV "32" DOT2 DOT4); break;
-          case Tap::One64     + Tap::One128    + Tap::One512: screen.print(QUAV "64" DOT2 DOT4); break;
-          case Tap::One128    + Tap::One256    + Tap::One1028: screen.print(QUAV "128" DOT2 DOT4); break;
-
-          case Tap::WholeT    + Tap::HalfT     + Tap::One8T: screen.print("WT" DOT2 DOT4); break;
-          case Tap::HalfT     + Tap::QuarterT  + Tap::One16T: screen.print("HT" DOT2 DOT4); break;
-          case Tap::QuarterT  + Tap::One8T     + Tap::One32T: screen.print("QT" DOT2 DOT4); break;
-          case Tap::One8T     + Tap::One16T    + Tap::One64T: screen.print(QUAV "8T" DOT2 DOT4); break;
-          case Tap::One16T    + Tap::One32T    + Tap::One128T: screen.print(QUAV "16T" DOT2 DOT4); break;
-          case Tap::One32T    + Tap::One64T    + Tap::One256T: screen.print(QUAV "32T" DOT2 DOT4); break;
-          case Tap::One64T    + Tap::One128T   + Tap::One512T: screen.print(QUAV "64T" DOT2 DOT4); break;
-          case Tap::One128T   + Tap::One256T   + Tap::One1028T: screen.print(QUAV "128T" DOT2 DOT4); break;
-
-          default: screen.print(tap); break;
-        }
-
-        //screen.print((int)TapTempo::samplePeriodToBpm(data.time, getSampleRate()));
-        //screen.print((int)data.time);
+        row.windowStart = quantize(1.0f - ((delayMatrix.freezePosition(i) + data.time.value) / maxFreezeSize));
+        row.windowSize = quantize(vessl::math::min(data.time.value / maxFreezeSize, 1.0f));
       }
       else
       {
-        screen.setCursor(x, static_cast<uint16_t>(rowY));
-        screen.print(ftoa(data.time.value / getSampleRate(), 10));
-        screen.print("s");
+        for (int f = 0; f < lineCount; ++f)
+        {
+          row.feedback[f] = quantize(delayParams[f].feedback[i].getValue());
+        }
       }
-      x += 44;
-      drawKnob(data.input.value, screen, x, knobY, knobRadius);
-      x += knobRadius * 2 + 4;
-      drawKnob((data.cutoff.value - Delaytrix::MIN_CUTOFF) / (Delaytrix::MAX_CUTOFF - Delaytrix::MIN_CUTOFF), screen, x, knobY, knobRadius);
-      x += knobRadius * 2 + 6;
-
-      //screen.setCursor(x, rowY);
-      //screen.print(ftoa(data.delayLength / getSampleRate(), 10));
-
-      if (freezeState == FreezeState::On)
+      RowState& cached = rowStates[i];
+      const bool labelChanged = cached.clocked != row.clocked || cached.label != row.label;
+      const bool rowChanged = refresh(cached, row);
+      if (redrawAll || labelChanged)
       {
-        const float windowStart = 1.0f - ((delayMatrix.freezePosition(i) + data.time.value) / maxFreezeSize);
-        const float windowSize = vessl::math::min(data.time.value / maxFreezeSize, 1.0f);
-        const int freezeX = x - knobRadius;
-        const int freezeY = knobY - knobRadius;
-        constexpr float freezeW = (knobRadius * 2 + 4)*DELAY_COUNT - 1;
-        //screen.setCursor(freezeX, rowY);
-        //screen.print(delays[i]->getPosition()/getSampleRate());
-        screen.drawRectangle(freezeX-1, freezeY, static_cast<int>(freezeW+1), 8, WHITE);
-        screen.fillRectangle(static_cast<int>(freezeW * windowStart + static_cast<float>(freezeX)), freezeY, static_cast<int>(vessl::math::max(freezeW * windowSize, 1.f)), 8, WHITE);
+        updateLabel(i, data);
       }
-      else
+
+      // the heading and the first row overlap, so they are always drawn together
+      if (i == 0 ? redrawAll || headingChanged || rowChanged : !redrawAll && rowChanged)
       {
-        for (int f = 0; f < DELAY_COUNT; ++f)
+        const uint16_t top = i == 0 ? HEADING_Y + 1 : rowY(i) - 11;
+        screen.fillRectangle(0, top, DRY_WET_X - 2, rowY(i) + 2 - top, BLACK);
+        if (i == 0)
         {
-          drawFeedLabel(screen, x - knobRadius, headingY, f + 1);
-          float fbk = getParameterValue(delayParams[f].feedback[i]);
-          drawKnob(fbk, screen, x+1, knobY, knobRadius);
-          x += knobRadius * 2 + 4;
+          // the frozen length in the heading can run over the top of the dry/wet bar
+          screen.fillRectangle(0, 0, screen.getWidth(), HEADING_Y + 1, BLACK);
+          drawHeading(screen, frozen, maxFreezeSize);
         }
+        drawRow(screen, i, cached);
+      }
+      else if (redrawAll)
+      {
+        drawRow(screen, i, cached);
       }
     }
 
+    BarState bars = {};
+    bars.mod = quantize(delayMatrix.modValue());
+    bars.skew = quantize(static_cast<float>(delayMatrix.skew()));
+    bars.feedback = quantize(static_cast<float>(delayMatrix.feedback()));
+    bars.frozen = frozen;
     constexpr int horizBarHeight = 8;
     const int barY = screen.getHeight() - 1;
+    if (refresh(barState, bars) || redrawAll)
+    {
+      screen.fillRectangle(0, barY - horizBarHeight, DRY_WET_X - 2, horizBarHeight + 1, BLACK);
+      uint16_t x = 0;
+      drawMod(screen, x, barY, 37, horizBarHeight, delayMatrix.modValue());
 
-    x = 0;
-    drawMod(screen, x, barY, 37, horizBarHeight, delayMatrix.modValue());
-
-    x += 40;
-    drawSkew(screen, x, barY, 22, horizBarHeight, static_cast<float>(delayMatrix.skew()));
+      x += 40;
+      drawSkew(screen, x, barY, 22, horizBarHeight, static_cast<float>(delayMatrix.skew()));
 
-    x += 26;
-    drawFeedback<true>(screen, x, barY, 48, horizBarHeight, static_cast<float>(delayMatrix.feedback()));
+      x += 26;
+      drawFeedback<true>(screen, x, barY, 48, horizBarHeight, static_cast<float>(delayMatrix.feedback()));
+    }
 
-    x += 52;
-    drawDryWet(screen, x, barY, horizBarHeight, barY - matrixTop + 8, static_cast<float>(delayMatrix.dryWet()));
+    // the noise animates whenever there is any wet signal
+    const float dryWet = static_cast<float>(delayMatrix.dryWet());
+    if (redrawAll || dryWet != lastDryWet || dryWet > 0)
+    {
+      lastDryWet = dryWet;
+      screen.fillRectangle(DRY_WET_X, HEADING_Y + 1, screen.getWidth() - DRY_WET_X, screen.getHeight() - HEADING_Y - 1, BLACK);
+      drawDryWet(screen, DRY_WET_X, barY, horizBarHeight, barY - MATRIX_TOP + 8, dryWet);
+    }
 
     //x += 9;
     ////drawKnob(dryWet, screen, x, matrixTop + rowSpacing - knobRadius - 1, knobRadius);
@@ -416,6 +267,325 @@ public:
     //drawSkew(screen, x, barY, barW, skew);
   }
 private:
+  static constexpr uint16_t MATRIX_TOP = 17;
+  static constexpr uint16_t KNOB_RADIUS = 4;
+  static constexpr uint16_t ROW_SPACING = 12;
+  static constexpr uint16_t HEADING_Y = MATRIX_TOP - KNOB_RADIUS * 2 - 1;
+  static constexpr uint16_t DRY_WET_X = 118;
+
+  // what each region of the screen was drawn from, quantized to what makes a visible difference
+  struct HeadingState
+  {
+    int32_t clocked;
+    int32_t bpm;
+    int32_t frozen;
+    int32_t freezeMillis;
+  };
+
+  struct RowState
+  {
+    int32_t clocked;
+    // the tap division when clocked, otherwise the delay time in milliseconds
+    int32_t label;
+    int32_t input;
+    int32_t cutoff;
+    int32_t frozen;
+    int32_t windowStart;
+    int32_t windowSize;
+    int32_t feedback[lineCount];
+  };
+
+  struct BarState
+  {
+    int32_t mod;
+    int32_t skew;
+    int32_t feedback;
+    int32_t frozen;
+  };
+
+  const void* lastScreen = nullptr;
+  HeadingState headingState = {};
+  RowState rowStates[lineCount] = {};
+  BarState barState = {};
+  float lastDryWet = -1;
+  // the text for each row's time, only formatted when the time or tap it shows changes
+  char rowLabels[lineCount][16] = {};
+
+  static int32_t quantize(float value)
+  {
+    return static_cast<int32_t>(value * 256);
+  }
+
+  // copies now into cached and returns true when they differ
+  template<typename State>
+  static bool refresh(State& cached, const State& now)
+  {
+    if (memcmp(&cached, &now, sizeof(State)) != 0)
+    {
+      cached = now;
+      return true;
+    }
+    return false;
+  }
+
+  static constexpr uint16_t rowY(uint16_t row)
+  {
+    return MATRIX_TOP + ROW_SPACING * row;
+  }
+
+  int32_t tapFor(int line)
+  {
+    int clockMult = delayMatrix.clockMult();
+    int spreadDivMult = delayMatrix.spreadMult();
+    int tapFirst = Tap::Quarter / clockMult;
+    int spreadInc = spreadDivMult < 0 ? tapFirst / -spreadDivMult : tapFirst * spreadDivMult;
+    return tapFirst + spreadInc * line;
+  }
+
+  void updateLabel(int row, const DelayLineData& data)
+  {
+    char* label = rowLabels[row];
+    const RowState& state = rowStates[row];
+    const char* division = state.clocked ? tapLabel(static_cast<Tap>(state.label)) : nullptr;
+    if (division)
+    {
+      stpcpy(label, division);
+    }
+    else if (state.clocked && state.label != 0)
+    {
+      stpcpy(label, msg_itoa(static_cast<int>(state.label), 10));
+    }
+    else
+    {
+      // unclocked, or tap 0 which shows the time for easy debug
+      char* p = stpcpy(label, ftoa(data.time.value / getSampleRate(), 10));
+      if (!state.clocked)
+      {
+        stpcpy(p, "s");
+      }
+    }
+  }
+
+  void drawHeading(MonochromeScreenBuffer& screen, bool frozen, float maxFreezeSize)
+  {
+    uint16_t x = 0;
+    screen.setCursor(x, HEADING_Y);
+    if (headingState.clocked)
+    {
+      screen.print("Q=");
+      screen.print(static_cast<int>(headingState.bpm));
+    }
+    else
+    {
+      screen.print("TIME");
+    }
+    x += 39;
+    screen.setCursor(x, HEADING_Y);
+    screen.print("IN");
+    x += 14;
+    screen.setCursor(x, HEADING_Y);
+    screen.print("LP");
+    x += 14;
+
+    if (frozen)
+    {
+      screen.setCursor(x, HEADING_Y);
+      screen.print("/");
+      screen.print(ftoa(maxFreezeSize / getSampleRate(), 10));
+      screen.print("s\\");
+    }
+    else
+    {
+      x = 1 + 44 + KNOB_RADIUS * 2 + 4 + KNOB_RADIUS * 2 + 6;
+      for (int f = 0; f < lineCount; ++f)
+      {
+        drawFeedLabel(screen, x - KNOB_RADIUS, HEADING_Y, f + 1);
+        x += KNOB_RADIUS * 2 + 4;
+      }
+    }
+  }
+
+  void drawRow(MonochromeScreenBuffer& screen, uint16_t i, const RowState& row)
+  {
+    const uint16_t y = rowY(i);
+    const uint16_t knobY = y - KNOB_RADIUS - 1;
+    uint16_t x = 1;
+    screen.setCursor(x, y);
+    screen.print(rowLabels[i]);
+
+    x += 44;
+    drawKnob(row.input / 256.0f, screen, x, knobY, KNOB_RADIUS);
+    x += KNOB_RADIUS * 2 + 4;
+    drawKnob(row.cutoff / 256.0f, screen, x, knobY, KNOB_RADIUS);
+    x += KNOB_RADIUS * 2 + 6;
+
+    if (row.frozen)
+    {
+      const float windowStart = row.windowStart / 256.0f;
+      const float windowSize = row.windowSize / 256.0f;
+      const int freezeX = x - KNOB_RADIUS;
+      const int freezeY = knobY - KNOB_RADIUS;
+      constexpr float freezeW = (KNOB_RADIUS * 2 + 4)*lineCount - 1;
+      screen.drawRectangle(freezeX-1, freezeY, static_cast<int>(freezeW+1), 8, WHITE);
+      screen.fillRectangle(static_cast<int>(freezeW * windowStart + static_cast<float>(freezeX)), freezeY, static_cast<int>(vessl::math::max(freezeW * windowSize, 1.f)), 8, WHITE);
+    }
+    else
+    {
+      for (int f = 0; f < lineCount; ++f)
+      {
+        drawKnob(row.feedback[f] / 256.0f, screen, x+1, knobY, KNOB_RADIUS);
+        x += KNOB_RADIUS * 2 + 4;
+      }
+    }
+  }
+
+  // the name of a musical division, or nullptr when it isn't one we have a name for
+  static const char* tapLabel(Tap tap)
+  {
+    switch (tap)  // NOLINT(clang-diagnostic-switch-enum)
+    {
+#define QUAV ""
+#define DOT2 "."
+#define DOT4 ","
+#define DOT8 ";"
+      case Tap::Whole: return "W";
+      case Tap::Half: return "H";
+      case Tap::Quarter: return "Q";
+      case Tap::One8: return QUAV "8";
+      case Tap::One16: return QUAV "16";
+      case Tap::One32: return QUAV "32";
+      case Tap::One64: return QUAV "64";
+      case Tap::One128: return QUAV "128";
+      case Tap::One256: return QUAV "256";
+      case Tap::One512: return QUAV "512";
+
+      case Tap::WholeT: return "WT";
+      case Tap::HalfT: return "HT";
+      case Tap::QuarterT: return "QT";
+      case Tap::One8T: return QUAV "8T";
+      case Tap::One16T: return QUAV "16T";
+      case Tap::One32T: return QUAV "32T";
+      case Tap::One64T: return QUAV "64T";
+      case Tap::One128T: return QUAV "128T";
+      case Tap::One256T: return QUAV "256T";
+      case Tap::One512T: return QUAV "512T";
+      case Tap::One1028T: return QUAV "1028T";
+
+      case Tap::WholeTT: return "WTT";
+      case Tap::HalfTT: return "HTT";
+      case Tap::QuarterTT: return "QTT";
+      case Tap::One8TT: return QUAV "8TT";
+      case Tap::One16TT: return QUAV "16TT";
+      case Tap::One32TT: return QUAV "32TT";
+      case Tap::One64TT: return QUAV "64TT";
+      case Tap::One128TT: return QUAV "128TT";
+      case Tap::One256TT: return QUAV "256TT";
+      case Tap::One512TT: return QUAV "512TT";
+      case Tap::One1028TT: return QUAV "1028TT";
+
+      case Tap::Whole     + Tap::One8: return "W" DOT8;
+      case Tap::Half      + Tap::One16: return "H" DOT8;
+      case Tap::Quarter   + Tap::One32: return "Q" DOT8;
+      case Tap::One8      + Tap::One64: return QUAV "8" DOT8;
+      case Tap::One16     + Tap::One128: return QUAV "16" DOT8;
+      case Tap::One32     + Tap::One256: return QUAV "32" DOT8;
+      case Tap::One64     + Tap::One512: return QUAV "64" DOT8;
+      case Tap::One128    + Tap::One1028: return QUAV "128" DOT8;
+
+      case Tap::Whole     + Tap::Quarter: return "W" DOT4;
+      case Tap::Half      + Tap::One8: return "H" DOT4;
+      case Tap::Quarter   + Tap::One16: return "Q" DOT4;
+      case Tap::One8      + Tap::One32: return QUAV "8" DOT4;
+      case Tap::One16     + Tap::One64: return QUAV "16" DOT4;
+      case Tap::One32     + Tap::One128: return QUAV "32" DOT4;
+      case Tap::One64     + Tap::One256: return QUAV "64" DOT4;
+      case Tap::One128    + Tap::One512: return QUAV "128" DOT4;
+
+      case Tap::Whole     + Tap::Quarter  + Tap::One16: return "W" DOT4 DOT4;
+      case Tap::Half      + Tap::One8     + Tap::One32: return "H" DOT4 DOT4;
+      case Tap::Quarter   + Tap::One16    + Tap::One64: return "Q" DOT4 DOT4;
+      case Tap::One8      + Tap::One32    + Tap::One128: return QUAV "8" DOT4 DOT4;
+      case Tap::One16     + Tap::One64    + Tap::One256: return QUAV "16" DOT4 DOT4;
+      case Tap::One32     + Tap::One128   + Tap::One512: return QUAV "32" DOT4 DOT4;
+      case Tap::One64     + Tap::One256   + Tap::One1028: return QUAV "64" DOT4 DOT4;
+
+      case Tap::WholeT    + Tap::QuarterT: return "WT" DOT4;
+      case Tap::HalfT     + Tap::One8T: return "HT" DOT4;
+      case Tap::QuarterT  + Tap::One16T: return "QT" DOT4;
+      case Tap::One8T     + Tap::One32T: return QUAV "8T" DOT4;
+      case Tap::One16T    + Tap::One64T: return QUAV "16T" DOT4;
+      case Tap::One32T    + Tap::One128T: return QUAV "32T" DOT4;
+      case Tap::One64T    + Tap::One256T: return QUAV "64T" DOT4;
+      case Tap::One128T   + Tap::One512T: return QUAV "128T" DOT4;
+
+      case Tap::WholeTT   + Tap::QuarterTT: return "WTT" DOT4;
+      case Tap::HalfTT    + Tap::One8TT: return "HTT" DOT4;
+      case Tap::QuarterTT + Tap::One16TT: return "QTT" DOT4;
+      case Tap::One8TT    + Tap::One32TT: return QUAV "8TT" DOT4;
+      case Tap::One16TT   + Tap::One64TT: return QUAV "16TT" DOT4;
+      case Tap::One32TT   + Tap::One128TT: return QUAV "32TT" DOT4;
+      case Tap::One64TT   + Tap::One256TT: return QUAV "64TT" DOT4;
+      case Tap::One128TT  + Tap::One512TT: return QUAV "128TT" DOT4;
+
+      case Tap::Whole     + Tap::Half: return "W" DOT2;
+      case Tap::Half      + Tap::Quarter: return "H" DOT2;
+      case Tap::Quarter   + Tap::One8: return "Q" DOT2;
+      case Tap::One8      + Tap::One16: return QUAV "8" DOT2;
+      case Tap::One16     + Tap::One32: return QUAV "16" DOT2;
+      case Tap::One32     + Tap::One64: return QUAV "32" DOT2;
+      case Tap::One64     + Tap::One128: return QUAV "64" DOT2;
+      case Tap::One128    + Tap::One256: return QUAV "128" DOT2;
+      case Tap::One256    + Tap::One512: return QUAV "256" DOT2;
+
+      case Tap::Whole     + Tap::Half      + Tap::Quarter: return "W" DOT2 DOT2;
+      case Tap::Half      + Tap::Quarter   + Tap::One8: return "H" DOT2 DOT2;
+      case Tap::Quarter   + Tap::One8      + Tap::One16: return "Q" DOT2 DOT2;
+      case Tap::One8      + Tap::One16     + Tap::One32: return QUAV "8" DOT2 DOT2;
+      case Tap::One16     + Tap::One32     + Tap::One64: return QUAV "16" DOT2 DOT2;
+      case Tap::One32     + Tap::One64     + Tap::One128: return QUAV "32" DOT2 DOT2;
+      case Tap::One64     + Tap::One128    + Tap::One256: return QUAV "64" DOT2 DOT2;
+      case Tap::One128    + Tap::One256    + Tap::One512: return QUAV "128" DOT2 DOT2;
+
+      case Tap::WholeT    + Tap::HalfT     + Tap::QuarterT: return "WT" DOT2 DOT2;
+      case Tap::QuarterT  + Tap::One8T     + Tap::One16T: return "QT" DOT2 DOT2;
+      case Tap::HalfT     + Tap::QuarterT  + Tap::One8T: return "HT" DOT2 DOT2;
+      case Tap::One8T     + Tap::One16T    + Tap::One32T: return QUAV "8T"  DOT2 DOT2;
+      case Tap::One16T    + Tap::One32T    + Tap::One64T: return QUAV "16T" DOT2 DOT2;
+      case Tap::One32T    + Tap::One64T    + Tap::One128T: return QUAV "32T" DOT2 DOT2;
+      case Tap::One64T    + Tap::One128T   + Tap::One256T: return QUAV "64T" DOT2 DOT2;
+      case Tap::One128T   + Tap::One256T   + Tap::One512T: return QUAV "128T" DOT2 DOT2;
+
+      case Tap::WholeTT   + Tap::HalfTT    + Tap::QuarterTT: return "WTT" DOT2 DOT2;
+      case Tap::QuarterTT + Tap::One8TT    + Tap::One16TT: return "QTT" DOT2 DOT2;
+      case Tap::HalfTT    + Tap::QuarterTT + Tap::One8TT: return "HTT" DOT2 DOT2;
+      case Tap::One8TT    + Tap::One16TT   + Tap::One32TT: return QUAV "8TT"  DOT2 DOT2;
+      case Tap::One16TT   + Tap::One32TT   + Tap::One64TT: return QUAV "16TT" DOT2 DOT2;
+      case Tap::One32TT   + Tap::One64TT   + Tap::One128TT: return QUAV "32TT" DOT2 DOT2;
+      case Tap::One64TT   + Tap::One128TT  + Tap::One256TT: return QUAV "64TT" DOT2 DOT2;
+      case Tap::One128TT  + Tap::One256TT  + Tap::One512TT: return QUAV "128TT" DOT2 DOT2;
+
+      case Tap::Whole     + Tap::Half      + Tap::One8: return "W" DOT2 DOT4;
+      case Tap::Half      + Tap::Quarter   + Tap::One16: return "H" DOT2 DOT4;
+      case Tap::Quarter   + Tap::One8      + Tap::One32: return "Q" DOT2 DOT4;
+      case Tap::One8      + Tap::One16     + Tap::One64: return QUAV "8" DOT2 DOT4;
+      case Tap::One16     + Tap::One32     + Tap::One128: return QUAV "16" DOT2 DOT4;
+      case Tap::One32     + Tap::One64     + Tap::One256: return QUAV "32" DOT2 DOT4;
+      case Tap::One64     + Tap::One128    + Tap::One512: return QUAV "64" DOT2 DOT4;
+      case Tap::One128    + Tap::One256    + Tap::One1028: return QUAV "128" DOT2 DOT4;
+
+      case Tap::WholeT    + Tap::HalfT     + Tap::One8T: return "WT" DOT2 DOT4;
+      case Tap::HalfT     + Tap::QuarterT  + Tap::One16T: return "HT" DOT2 DOT4;
+      case Tap::QuarterT  + Tap::One8T     + Tap::One32T: return "QT" DOT2 DOT4;
+      case Tap::One8T     + Tap::One16T    + Tap::One64T: return QUAV "8T" DOT2 DOT4;
+      case Tap::One16T    + Tap::One32T    + Tap::One128T: return QUAV "16T" DOT2 DOT4;
+      case Tap::One32T    + Tap::One64T    + Tap::One256T: return QUAV "32T" DOT2 DOT4;
+      case Tap::One64T    + Tap::One128T   + Tap::One512T: return QUAV "64T" DOT2 DOT4;
+      case Tap::One128T   + Tap::One256T   + Tap::One1028T: return QUAV "128T" DOT2 DOT4;
+
+      default: return nullptr;
+    }
+  }
+
   static void drawFeedLabel(MonochromeScreenBuffer& screen, uint16_t x, uint16_t y, int num)
   {
     const int ac = y - 5;
@@ -474,7 +644,7 @@ private:
     const int iconY = y-2;
     const int iconDim = h-2;
 
-    FreezeState freezeState = delayMatrix.freeze().read<FreezeState>();
+    FreezeState freezeState = delayMatrix.freeze().template read<FreezeState>();
     if (freezeState == FreezeState::On)
     {
       screen.drawLine(x, iconY, x, iconY - iconDim, WHITE);
@@ -570,3 +740,5 @@ private:
   }
 
 };
+
+typedef DelaytrixPatchTemplate<4> DelaytrixPatch;
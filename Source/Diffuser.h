@@ -3,52 +3,87 @@
 
 #include "SignalProcessor.h"
 #include "AudioBuffer.h"
-#include "AllpassNetwork.h"
+#include "MultiAllpassNetwork.h"
+#include "SilenceDetector.h"
 
-class Diffuser : public MultiSignalProcessor
+// StorageType is the sample type the delay lines are kept in, see DelayStorage.h
+template<typename StorageType>
+class DiffuserTemplate : public MultiSignalProcessor
 {
-  static const int kBufferSize = 2048;
+  using Network = MultiAllpassNetwork<2, StorageType>;
 
-  AllpassNetwork* apl;
-  AllpassNetwork* apr;
+  // the delay lengths below are tuned for this sample rate and scaled to the one we run at
+  static constexpr float kReferenceSampleRate = 48000.0f;
 
-  Diffuser(AllpassNetwork* apl, AllpassNetwork* apr)
-    : apl(apl), apr(apr)
+  // left and right are processed together, each with their own delay lengths
+  Network* ap;
+  // the network's delay lines are carved out of this
+  StorageType* pool;
+  SilenceDetector silence;
+
+  DiffuserTemplate(Network* ap, StorageType* pool)
+    : ap(ap), pool(pool), silence(ap->getMemoryLength())
   {
   }
 
 public:
   void setAmount(float amt)
   {
-    apl->setAmount(amt);
-    apr->setAmount(amt);
+    ap->setAmount(amt);
   }
 
   void process(AudioBuffer& input, AudioBuffer& output) override
   {
-    int size = input.getSize();
     FloatArray inL = input.getSamples(0);
     FloatArray inR = input.getSamples(1);
-    FloatArray outL = output.getSamples(0);
-    FloatArray outR = output.getSamples(1);
+    const float leftPeak = SilenceDetector::peak(inL);
+    const float rightPeak = SilenceDetector::peak(inR);
+    const float inputPeak = leftPeak > rightPeak ? leftPeak : rightPeak;
+    if (silence.isSilent(inputPeak))
+    {
+      // nothing is left ringing in the allpasses and the input is below -120 dB, so just pass it through
+      if (&input != &output)
+      {
+        output.copyFrom(input);
+      }
+      return;
+    }
 
-    apl->process(inL, outL);
-    apr->process(inR, outR);
+    ap->process(input, output);
+    const float wetPeak = ap->getWetPeak();
+    silence.update(inputPeak > wetPeak ? inputPeak : wetPeak, input.getSize());
   }
 
-  static Diffuser* create()
+  static DiffuserTemplate* create(float sr)
   {
-    static size_t leftLen[4]{ 126, 180, 269, 444 };
-    static size_t rightLen[4]{ 151, 205, 245, 405 };
-    AllpassNetwork* apl = AllpassNetwork::create(leftLen, 4, 0.625f);
-    AllpassNetwork* apr = AllpassNetwork::create(rightLen, 4, 0.625f);
-    return new Diffuser(apl, apr);
+    static const size_t leftTimes[4]{ 126, 180, 269, 444 };
+    static const size_t rightTimes[4]{ 151, 205, 245, 405 };
+    const float scale = sr / kReferenceSampleRate;
+    size_t leftLen[4];
+    size_t rightLen[4];
+    for (int i = 0; i < 4; ++i)
+    {
+      leftLen[i] = (size_t)(leftTimes[i] * scale + 0.5f);
+      rightLen[i] = (size_t)(rightTimes[i] * scale + 0.5f);
+    }
+
+    const size_t* lengths[2] { leftLen, rightLen };
+    const size_t poolSize = Network::getBufferSize(lengths, 4);
+    StorageType* pool = new StorageType[poolSize];
+    memset(pool, 0, sizeof(StorageType)*poolSize);
+    return new DiffuserTemplate(Network::create(lengths, 4, 0.625f, pool), pool);
   }
 
-  static void destroy(Diffuser* diffuser)
+  static void destroy(DiffuserTemplate* diffuser)
   {
-    AllpassNetwork::destroy(diffuser->apl);
-    AllpassNetwork::destroy(diffuser->apr);
+    Network::destroy(diffuser->ap);
+    delete[] diffuser->pool;
     delete diffuser;
   }
 };
+
+typedef DiffuserTemplate<float> Diffuser;
+typedef DiffuserTemplate<int16_t> ShortDiffuser;
+#ifdef DELAY_STORAGE_HALF
+typedef DiffuserTemplate<Half> HalfDiffuser;
+#endif
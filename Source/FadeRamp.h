@@ -0,0 +1,117 @@
+#pragma once
+#ifndef __FADE_RAMP_H__
+#define __FADE_RAMP_H__
+
+#include "FloatArray.h"
+
+// Precomputed gain tables for fading and crossfading a block at a time.
+// A span is split into the part that lies in the fade in, the steady part and the part that lies in the fade out,
+// so each part is a straight multiply with the table instead of a per sample check of where the fade has got to.
+// Linear fades keep the gains summing to one, equal power fades keep the squared gains summing to one.
+class FadeRamp
+{
+  // fadeIn[k] is the gain k samples into a fade and fadeOut[k] = fadeIn[length - k], both have length + 1 entries.
+  float* fadeIn;
+  float* fadeOut;
+  size_t maxLength;
+  size_t length;
+  bool equalPower;
+
+  FadeRamp(float* fadeIn, float* fadeOut, size_t maxLength)
+    : fadeIn(fadeIn), fadeOut(fadeOut), maxLength(maxLength), length(0), equalPower(false)
+  {
+  }
+
+  void update()
+  {
+    for (size_t k = 0; k <= length; ++k)
+    {
+      const float x = length ? (float)k / length : 1.0f;
+      fadeIn[k] = equalPower ? sinf(x * M_PI * 0.5f) : x;
+    }
+    for (size_t k = 0; k <= length; ++k)
+    {
+      fadeOut[k] = fadeIn[length - k];
+    }
+  }
+
+public:
+  size_t getLength() const
+  {
+    return length;
+  }
+
+  // the tables are only recalculated when the length actually changes
+  void setLength(size_t len)
+  {
+    len = len < maxLength ? len : maxLength;
+    if (len != length)
+    {
+      length = len;
+      update();
+    }
+  }
+
+  void setEqualPower(bool enabled)
+  {
+    if (enabled != equalPower)
+    {
+      equalPower = enabled;
+      update();
+    }
+  }
+
+  // applies the gain to samples [pos, pos + len) of a window that is windowLength long,
+  // which fades in over its first length samples and out over its last length samples.
+  void applyWindow(float* samples, size_t pos, size_t len, size_t windowLength)
+  {
+    const size_t end = pos + len;
+    if (pos < length)
+    {
+      const size_t n = (end < length ? end : length) - pos;
+      FloatArray(samples, n).multiply(FloatArray(fadeIn + pos, n));
+    }
+    const size_t fadeOutStart = windowLength > length ? windowLength - length : 0;
+    if (end > fadeOutStart)
+    {
+      const size_t from = pos > fadeOutStart ? pos : fadeOutStart;
+      const size_t n = end - from;
+      FloatArray(samples + from - pos, n).multiply(FloatArray(fadeOut + from - fadeOutStart, n));
+    }
+  }
+
+  // crossfades samples [pos, pos + len) of a fade from one signal to another,
+  // past the end of the fade the output is the signal faded to. output may be the same array as either input.
+  void crossfade(const float* from, const float* to, float* output, size_t pos, size_t len)
+  {
+    const size_t n = pos < length ? (len < length - pos ? len : length - pos) : 0;
+    const float* gainIn = fadeIn + pos;
+    const float* gainOut = fadeOut + pos;
+    for (size_t i = 0; i < n; ++i)
+    {
+      output[i] = from[i] * gainOut[i] + to[i] * gainIn[i];
+    }
+    if (output != to)
+    {
+      memcpy(output + n, to + n, (len - n) * sizeof(float));
+    }
+  }
+
+  static FadeRamp* create(size_t maxLength, size_t length, bool equalPower = false)
+  {
+    float* tables = new float[(maxLength + 1) * 2];
+    FadeRamp* ramp = new FadeRamp(tables, tables + maxLength + 1, maxLength);
+    ramp->equalPower = equalPower;
+    ramp->length = length < maxLength ? length : maxLength;
+    ramp->update();
+    return ramp;
+  }
+
+  static void destroy(FadeRamp* ramp)
+  {
+    delete[] ramp->fadeIn;
+    delete ramp;
+  }
+};
+
+#endif // __FADE_RAMP_H__
@@ -0,0 +1,356 @@
+// Feedback delay network reverb: each delay line is damped by a one pole low pass,
+// scaled by a gain that gives every line the same decay time,
+// then mixed back into all of the lines through a Hadamard matrix.
+// Has the same controls as Reverb so that it can be used in its place.
+#pragma once
+
+#include "SignalProcessor.h"
+#include "AudioBuffer.h"
+#include "FloatArray.h"
+#include "AllpassNetwork.h"
+#include "DelayStorage.h"
+#include "SilenceDetector.h"
+
+// StorageType is the sample type the delay lines are kept in, see DelayStorage.h
+template<int lineCount, typename StorageType>
+class FdnReverbTemplate : public MultiSignalProcessor
+{
+  static_assert(lineCount >= 4 && lineCount <= 16 && (lineCount & (lineCount - 1)) == 0,
+                "FdnReverb line count must be a power of two between 4 and 16");
+
+  using Storage = DelayStorage<StorageType>;
+  using Allpass = AllpassNetworkTemplate<StorageType>;
+
+  // all of the delay times are tuned for this sample rate and scaled to the one we run at
+  static constexpr float kReferenceSampleRate = 48000.0f;
+
+  // length in samples that the reverb time gain is applied over,
+  // chosen so that a tail dies away at about the same rate as Reverb's with the same reverb time.
+  static constexpr float kDecayLength = 4300.0f;
+
+  // bit n set means the input is subtracted from line n,
+  // so that the input doesn't line up with any one row of the matrix.
+  static constexpr uint32_t kInputSigns = 0x9B52;
+
+  // power of two sized delay line, writePos is where the next sample will be written.
+  struct DelayLine
+  {
+    StorageType* buf;
+    size_t writePos;
+    size_t mask;
+    size_t length;
+  };
+
+  Allpass* diffuser;
+  DelayLine lines[lineCount];
+  float lowPass[lineCount];
+  float lineGain[lineCount];
+  // every delay line and the scratch memory are carved out of this
+  char* pool;
+  size_t poolSize;
+  // a block for each line, followed by the diffused input and the left and right wet signal
+  float* scratch;
+  int blockSize;
+  SilenceDetector silence;
+
+  float inputGain;
+  float reverbTime;
+  float lpAmount;
+  float wetAmount;
+  float outputGain;
+  // kDecayLength at our sample rate
+  float decayLength;
+
+  FdnReverbTemplate(Allpass* diffuser, char* pool, int blockSize)
+    : diffuser(diffuser), pool(pool), blockSize(blockSize)
+    , inputGain(0.2f), reverbTime(-1), lpAmount(0.7f), wetAmount(0)
+  {
+    // each output sums half of the lines, which are uncorrelated. brings the tail up to about Reverb's level.
+    outputGain = 4.0f / sqrtf(lineCount / 2);
+    memset(lowPass, 0, sizeof(lowPass));
+    diffuser->setAmount(1.0f);
+    setDiffusion(0.625f);
+  }
+
+public:
+
+  static FdnReverbTemplate* create(float sr, int blockSize)
+  {
+    // mutually prime lengths, lineCount of them are taken evenly spread from the longest end of each group
+    static const size_t lineTimes[16] {  601,  673,  787,  883, 1021, 1117, 1259, 1373,
+                                        1493, 1637, 1777, 1913, 2063, 2221, 2399, 2579 };
+    static const size_t diffuseTimes[2] { 113, 162 };
+
+    const float scale = sr / kReferenceSampleRate;
+    size_t diffuseLen[2];
+    for (int i = 0; i < 2; ++i)
+    {
+      diffuseLen[i] = scaled(diffuseTimes[i], scale);
+    }
+
+    const int stride = 16 / lineCount;
+    size_t lineLen[lineCount];
+    size_t lineSize[lineCount];
+    size_t totalSize = Allpass::getBufferSize(diffuseLen, 2);
+    for (int i = 0; i < lineCount; ++i)
+    {
+      lineLen[i] = scaled(lineTimes[i * stride + stride - 1], scale);
+      lineSize[i] = Allpass::getPaddedLength(lineLen[i] + blockSize);
+      totalSize += lineSize[i];
+    }
+    // lines are read a block at a time before the block is written
+    ASSERT(blockSize <= (int)lineLen[0], "FdnReverb block size is longer than its shortest delay!");
+
+    // every line is a power of two long, so the float scratch at the end stays aligned
+    const size_t poolSize = totalSize * sizeof(StorageType) + blockSize * (lineCount + 3) * sizeof(float);
+    char* pool = new char[poolSize];
+    memset(pool, 0, poolSize);
+
+    StorageType* head = reinterpret_cast<StorageType*>(pool);
+    Allpass* diffuser = Allpass::create(diffuseLen, 2, 0.625f, head);
+    head += Allpass::getBufferSize(diffuseLen, 2);
+
+    FdnReverbTemplate* reverb = new FdnReverbTemplate(diffuser, pool, blockSize);
+    for (int i = 0; i < lineCount; ++i)
+    {
+      reverb->lines[i] = { head, 0, lineSize[i] - 1, lineLen[i] };
+      head += lineSize[i];
+    }
+    reverb->scratch = reinterpret_cast<float*>(head);
+    reverb->poolSize = poolSize;
+    reverb->silence.setMemoryLength(totalSize);
+    reverb->decayLength = kDecayLength * scale;
+    reverb->setReverbTime(0);
+    return reverb;
+  }
+
+  // bytes of delay and scratch memory used
+  size_t getMemorySize() const
+  {
+    return poolSize;
+  }
+
+  static void destroy(FdnReverbTemplate* reverb)
+  {
+    Allpass::destroy(reverb->diffuser);
+    delete[] reverb->pool;
+    delete reverb;
+  }
+
+  void setInputGain(float amt)
+  {
+    inputGain = amt;
+  }
+
+  // diffusion of the two allpasses the input goes through before entering the network
+  void setDiffusion(float amt)
+  {
+    diffuser->setDiffusion(amt);
+  }
+
+  // the gain applied to the signal every kDecayLength samples,
+  // spread over the lines in proportion to their lengths.
+  void setReverbTime(float rvt)
+  {
+    if (rvt == reverbTime)
+    {
+      return;
+    }
+    reverbTime = rvt;
+    // the matrix is scaled by this to stay lossless
+    const float norm = 1.0f / sqrtf(lineCount);
+    for (int i = 0; i < lineCount; ++i)
+    {
+      lineGain[i] = powf(rvt, lines[i].length / decayLength) * norm;
+    }
+  }
+
+  void setLowPass(float lp)
+  {
+    lpAmount = lp;
+  }
+
+  void setAmount(float amt)
+  {
+    wetAmount = amt;
+  }
+
+  void process(AudioBuffer& input, AudioBuffer& output) override
+  {
+    const float* inL = input.getSamples(0);
+    const float* inR = input.getSamples(1);
+    float* outL = output.getSamples(0);
+    float* outR = output.getSamples(1);
+    int size = input.getSize();
+
+    const float leftPeak = SilenceDetector::peak(input.getSamples(0));
+    const float rightPeak = SilenceDetector::peak(input.getSamples(1));
+    const float inputPeak = leftPeak > rightPeak ? leftPeak : rightPeak;
+    if (silence.isSilent(inputPeak))
+    {
+      // the tail has died away and the input is below -120 dB, so all that is left is the dry signal
+      const float dryAmount = 1.0f - wetAmount;
+      for (int i = 0; i < size; ++i)
+      {
+        outL[i] = inL[i] * dryAmount;
+        outR[i] = inR[i] * dryAmount;
+      }
+      return;
+    }
+
+    float peak = inputPeak;
+    while (size)
+    {
+      const int len = size < blockSize ? size : blockSize;
+      const float linePeak = processBlock(inL, inR, outL, outR, len);
+      peak = linePeak > peak ? linePeak : peak;
+      inL += len;
+      inR += len;
+      outL += len;
+      outR += len;
+      size -= len;
+    }
+    silence.update(peak, input.getSize());
+  }
+
+private:
+  // input and output may be the same arrays, since output is written after the input has been used.
+  // returns the peak of what was read out of the lines.
+  float processBlock(const float* inL, const float* inR, float* outL, float* outR, const int len)
+  {
+    float* diffused = scratch + lineCount * blockSize;
+    float* wetL = diffused + blockSize;
+    float* wetR = wetL + blockSize;
+
+    for (int i = 0; i < len; ++i)
+    {
+      diffused[i] = (inL[i] + inR[i]) * inputGain;
+    }
+    FloatArray block(diffused, len);
+    diffuser->process(block, block);
+
+    // every line is at least a block long, so the whole block can be read before any of it is written
+    float peak = 0;
+    for (int l = 0; l < lineCount; ++l)
+    {
+      float* x = scratch + l * blockSize;
+      readDelay(lines[l], x, lines[l].length, len);
+      const float p = SilenceDetector::peak(FloatArray(x, len));
+      peak = p > peak ? p : peak;
+
+      float lp = lowPass[l];
+      const float g = lineGain[l];
+      for (int i = 0; i < len; ++i)
+      {
+        lp += lpAmount * (x[i] - lp);
+        x[i] = lp * g;
+      }
+      lowPass[l] = lp;
+    }
+
+    // like Reverb the wet signal carries the diffused input, then even lines go to the left and odd lines to the right
+    memcpy(wetL, diffused, len * sizeof(float));
+    memcpy(wetR, diffused, len * sizeof(float));
+    for (int l = 0; l < lineCount; l += 2)
+    {
+      const float* xl = scratch + l * blockSize;
+      const float* xr = xl + blockSize;
+      for (int i = 0; i < len; ++i)
+      {
+        wetL[i] += xl[i];
+        wetR[i] += xr[i];
+      }
+    }
+
+    // fast Walsh-Hadamard transform across the lines, a whole block per butterfly
+    for (int h = 1; h < lineCount; h <<= 1)
+    {
+      for (int l = 0; l < lineCount; l += h * 2)
+      {
+        for (int k = l; k < l + h; ++k)
+        {
+          float* a = scratch + k * blockSize;
+          float* b = a + h * blockSize;
+          for (int i = 0; i < len; ++i)
+          {
+            const float s = a[i];
+            const float d = b[i];
+            a[i] = s + d;
+            b[i] = s - d;
+          }
+        }
+      }
+    }
+
+    for (int l = 0; l < lineCount; ++l)
+    {
+      float* x = scratch + l * blockSize;
+      if (kInputSigns & (1 << l))
+      {
+        for (int i = 0; i < len; ++i)
+        {
+          x[i] -= diffused[i];
+        }
+      }
+      else
+      {
+        for (int i = 0; i < len; ++i)
+        {
+          x[i] += diffused[i];
+        }
+      }
+      writeDelay(lines[l], x, len);
+    }
+
+    for (int i = 0; i < len; ++i)
+    {
+      outL[i] = inL[i] + (wetL[i] * outputGain - inL[i]) * wetAmount;
+      outR[i] = inR[i] + (wetR[i] * outputGain - inR[i]) * wetAmount;
+    }
+    return peak;
+  }
+
+  // copies len samples into the line in at most two contiguous spans
+  static void writeDelay(DelayLine& d, const float* src, size_t len)
+  {
+    const size_t span = d.mask + 1 - d.writePos;
+    if (len > span)
+    {
+      Storage::storeBlock(src, d.buf + d.writePos, span);
+      Storage::storeBlock(src + span, d.buf, len - span);
+    }
+    else
+    {
+      Storage::storeBlock(src, d.buf + d.writePos, len);
+    }
+    d.writePos = (d.writePos + len) & d.mask;
+  }
+
+  // copies len samples starting delay samples behind the write position in at most two contiguous spans
+  static void readDelay(const DelayLine& d, float* dst, size_t delay, size_t len)
+  {
+    const size_t readPos = (d.writePos - delay) & d.mask;
+    const size_t span = d.mask + 1 - readPos;
+    if (len > span)
+    {
+      Storage::loadBlock(d.buf + readPos, dst, span);
+      Storage::loadBlock(d.buf, dst + span, len - span);
+    }
+    else
+    {
+      Storage::loadBlock(d.buf + readPos, dst, len);
+    }
+  }
+
+  static size_t scaled(size_t len, float scale)
+  {
+    return (size_t)(len * scale + 0.5f);
+  }
+};
+
+typedef FdnReverbTemplate<8, float> FdnReverb;
+typedef FdnReverbTemplate<16, float> FdnReverb16;
+typedef FdnReverbTemplate<8, int16_t> ShortFdnReverb;
+#ifdef DELAY_STORAGE_HALF
+typedef FdnReverbTemplate<8, Half> HalfFdnReverb;
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Patch.h"
+#include "Reverb.h"
+#include "FdnReverb.h"
+
+// Compares the cost of Reverb with the 8 and 16 line FdnReverb.
+// All three run every block on the same input, parameter A picks which one is heard.
+class FdnReverbTestPatch : public Patch
+{
+  Reverb* reverb;
+  FdnReverb* fdn8;
+  FdnReverb16* fdn16;
+  AudioBuffer* fdn8Buffer;
+  AudioBuffer* fdn16Buffer;
+
+public:
+  FdnReverbTestPatch() : Patch()
+  {
+    reverb = Reverb::create(getSampleRate(), getBlockSize());
+    fdn8 = FdnReverb::create(getSampleRate(), getBlockSize());
+    fdn16 = FdnReverb16::create(getSampleRate(), getBlockSize());
+    fdn8Buffer = AudioBuffer::create(2, getBlockSize());
+    fdn16Buffer = AudioBuffer::create(2, getBlockSize());
+
+    registerParameter(PARAMETER_A, "Reverb");
+    registerParameter(PARAMETER_B, "Time");
+    registerParameter(PARAMETER_F, "Dattorro CPU>>");
+    registerParameter(PARAMETER_G, "FDN 8 CPU>>");
+    registerParameter(PARAMETER_H, "FDN 16 CPU>>");
+    setParameterValue(PARAMETER_B, 0.5f);
+
+    debugMessage("Reverb bytes d/8/16", (int)reverb->getMemorySize(), (int)fdn8->getMemorySize(), (int)fdn16->getMemorySize());
+  }
+
+  ~FdnReverbTestPatch()
+  {
+    Reverb::destroy(reverb);
+    FdnReverb::destroy(fdn8);
+    FdnReverb16::destroy(fdn16);
+    AudioBuffer::destroy(fdn8Buffer);
+    AudioBuffer::destroy(fdn16Buffer);
+  }
+
+  // returns CPU% as [0,1] value
+  float getElapsedTime()
+  {
+    return getElapsedCycles() / getBlockSize() / 10000.0f;
+  }
+
+  void processAudio(AudioBuffer& audio) override
+  {
+    fdn8Buffer->copyFrom(audio);
+    fdn16Buffer->copyFrom(audio);
+    const float reverbTime = 0.35f + 0.6f*getParameterValue(PARAMETER_B);
+
+    float time = getElapsedTime();
+    process(reverb, reverbTime, audio);
+    float reverbCost = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    process(fdn8, reverbTime, *fdn8Buffer);
+    float fdn8Cost = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    process(fdn16, reverbTime, *fdn16Buffer);
+    float fdn16Cost = getElapsedTime() - time;
+
+    float which = getParameterValue(PARAMETER_A);
+    if (which > 0.66f)
+    {
+      audio.copyFrom(*fdn16Buffer);
+    }
+    else if (which > 0.33f)
+    {
+      audio.copyFrom(*fdn8Buffer);
+    }
+
+    setParameterValue(PARAMETER_F, reverbCost);
+    setParameterValue(PARAMETER_G, fdn8Cost);
+    setParameterValue(PARAMETER_H, fdn16Cost);
+  }
+
+private:
+  template<typename ReverbType>
+  static void process(ReverbType* reverb, float reverbTime, AudioBuffer& audio)
+  {
+    reverb->setDiffusion(0.7f);
+    reverb->setReverbTime(reverbTime);
+    reverb->setLowPass(0.8f);
+    reverb->setAmount(0.5f);
+    reverb->process(audio, audio);
+  }
+};
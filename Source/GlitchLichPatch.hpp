@@ -56,6 +56,7 @@ DESCRIPTION:
 #include "Patch.h"
 #include "DcBlockingFilter.h"
 #include "CircularBuffer.h"
+#include "InterpolatedRead.h"
 
 #include "TapTempo.hpp"
 #include "vessicle/vessl/vessl.h"
@@ -151,6 +152,9 @@ static const uint32_t DROP_COUNTERS[DROP_RATIOS_COUNT] = {
 
 class GlitchLichPatch : public Patch
 {
+  // linear reads audibly dull the freeze loop when it is played back slower than it was recorded
+  using FreezeRead = InterpolatedRead<InterpolationQuality::Lagrange>;
+
   const PatchParameterId inSize = PARAMETER_A;
   const PatchParameterId inSpeed = PARAMETER_B;
   const PatchParameterId inDrop = PARAMETER_C;
@@ -243,15 +247,6 @@ public:
     return false;
   }
 
-  inline float interpolatedReadAt(CircularBuffer<float>* buffer, float index) 
-  {
-    size_t idx = (size_t)index;
-    float low = buffer->readAt(idx);
-    float high = buffer->readAt(idx + 1);
-    float frac = index - idx;
-    return high + frac * (low - high);
-  }
-
   float freezeDuration(int ratio)
   {
     float dur = tempo.getPeriod() * FREEZE_RATIOS[ratio];
@@ -342,12 +337,13 @@ public:
       float x0 = 1.0f - x1;
       if (freeze)
       {
-        float read0 = readStartIdx + readLfo * freezeLength;
-        float read1 = readStartIdx + readLfo * newFreezeLength;
-        left[i]  = interpolatedReadAt(bufferL, read0)*x0 
-                 + interpolatedReadAt(bufferL, read1)*x1;
-        right[i] = interpolatedReadAt(bufferR, read0)*x0 
-                 + interpolatedReadAt(bufferR, read1)*x1;
+        // both channels are read at the same positions, so the taps are only worked out once
+        FreezeRead::Taps read0 = FreezeRead::at(readStartIdx + readLfo * freezeLength);
+        FreezeRead::Taps read1 = FreezeRead::at(readStartIdx + readLfo * newFreezeLength);
+        left[i]  = FreezeRead::read(bufferL->getData(), TRIGGER_LIMIT - 1, read0)*x0
+                 + FreezeRead::read(bufferL->getData(), TRIGGER_LIMIT - 1, read1)*x1;
+        right[i] = FreezeRead::read(bufferR->getData(), TRIGGER_LIMIT - 1, read0)*x0
+                 + FreezeRead::read(bufferR->getData(), TRIGGER_LIMIT - 1, read1)*x1;
       }
       stepReadLFO(readSpeed*x0 + newReadSpeed*x1);
     }
@@ -0,0 +1,587 @@
+#pragma once
+
+#include <string.h>
+#include "FloatArray.h"
+#include "basicmaths.h"
+#include "ScratchArena.h"
+#include "InterpolatedRead.h"
+#include "GrainWindows.h"
+#include "DelayStorage.h"
+
+// one frame of a stereo buffer
+template<typename StorageType>
+struct StereoFrame
+{
+  StorageType left;
+  StorageType right;
+};
+
+// Every grain of a granulator, reading from one stereo record buffer.
+// The state of the grains is kept as one array per field rather than one object per grain,
+// so that grains can be rendered a group at a time: each sample of the block is worked out for
+// every grain in the group before moving on to the next, the group's sum is added to the output once,
+// and the group's state stays in registers for the whole block instead of being reloaded for every grain.
+// The Cortex-M7 has no vector unit for floats, so the lanes of a group are unrolled scalar code,
+// which still gets the compiler to interleave the independent work of each grain.
+// Grains that start or end part way through a block are rendered on their own.
+// The record buffer can be stored as any DelayStorage type, FullScaleShort takes half the memory of float.
+// The stages grains read from are always float, converted a span at a time as they are filled,
+// so reading shorts only costs a bulk conversion of each frame once, not one per tap.
+template<int capacity, typename StorageType = float>
+class GrainBank
+{
+public:
+  typedef StereoFrame<StorageType> RecordFrame;
+  typedef StereoFrame<float> StageFrame;
+
+private:
+  using Storage = DelayStorage<StorageType>;
+  // read one channel of a stage or the record buffer
+  using Read = InterpolatedRead<InterpolationQuality::Linear, float, 2>;
+  using RecordRead = InterpolatedRead<InterpolationQuality::Linear, StorageType, 2>;
+
+  // grains rendered together
+  static constexpr int kGroupSize = 4;
+  // a block is rendered in segments of this many samples.
+  // the copy for the next block is done a segment's worth at a time,
+  // and the envelope is read from its table at each end of a segment and drawn as a straight line between.
+  static constexpr int kSegmentLength = 8;
+
+  RecordFrame* buffer;
+  GrainWindows* windows;
+  const int bufferSize;
+  const int bufferWrapMask;
+
+  // every grain's index, the playing ones first and then the free ones,
+  // so both sets can be walked without looking at the rest and a grain moves between them with one swap.
+  int order[capacity];
+  // where each grain is in order
+  int slot[capacity];
+  int playingCount;
+
+  int preDelay[capacity];
+  float ramp[capacity];
+  float start[capacity];
+  float size[capacity];
+  float speed[capacity];
+  // the window table and what turns ramp into its phase
+  const float* window[capacity];
+  float phaseScale[capacity];
+  // grains that are stopped early fade out as well, by (size - ramp) * fadeMult
+  bool fading[capacity];
+  float fadeMult[capacity];
+  // pan and velocity
+  float leftGain[capacity];
+  float rightGain[capacity];
+
+  // the record buffer lives in SDRAM, which is by far the slowest thing a grain touches.
+  // so a grain reads from a copy of the stretch of the buffer it needs for the block,
+  // and while it renders one block it copies what it will need for the next one into its other stage,
+  // a few frames for each sample it renders, so those reads overlap with the interpolation
+  // instead of all waiting on SDRAM in one go at the start of the block.
+  // the first block after a trigger, or a block that doesn't land where it was expected to, copies its stretch before rendering.
+  const int stageCapacity;
+  StageFrame* stageData[capacity][2];
+  // where data[0] came from in the record buffer
+  int stageOffset[capacity][2];
+  // 0 when nothing is staged
+  int stageLength[capacity][2];
+  // the stage being read from, the other is filled for the next block
+  uint8_t current[capacity];
+
+  // worked out for each grain at the start of a block.
+  // src is the stage, or null when the grain is too fast for its stages and reads the record buffer itself.
+  const StageFrame* src[capacity];
+  // buffer index of src[0] when reading a stage
+  int first[capacity];
+  // read position relative to the sample after first is origin + ramp
+  float origin[capacity];
+  int fetchCount[capacity];
+  int fetchPerSample[capacity];
+  int fetched[capacity];
+
+  GrainBank(RecordFrame* inBuffer, int bufferSz, ScratchArena* scratch, int stageFrames)
+    : buffer(inBuffer), windows(GrainWindows::create()), bufferSize(bufferSz), bufferWrapMask(bufferSz - 1), playingCount(0), stageCapacity(stageFrames)
+  {
+    for (int g = 0; g < capacity; ++g)
+    {
+      order[g] = slot[g] = g;
+      preDelay[g] = 0;
+      ramp[g] = randf()*bufferSize;
+      start[g] = fadeMult[g] = 0;
+      size[g] = bufferSize;
+      phaseScale[g] = 1.0f / bufferSize;
+      window[g] = windows->get(0.5f);
+      fading[g] = false;
+      speed[g] = leftGain[g] = rightGain[g] = 1;
+      current[g] = 0;
+      for (int s = 0; s < 2; ++s)
+      {
+        stageData[g][s] = scratch->reserve<StageFrame>(stageCapacity);
+        stageOffset[g][s] = 0;
+        stageLength[g][s] = 0;
+      }
+    }
+  }
+
+public:
+  static constexpr int getCapacity()
+  {
+    return capacity;
+  }
+
+  static inline RecordFrame makeFrame(float left, float right)
+  {
+    return { Storage::store(left), Storage::store(right) };
+  }
+
+  // converts count frames into the record buffer from offset, which wraps to the start of the buffer,
+  // in at most two contiguous spans rather than masking the index of every frame
+  void write(int offset, const StageFrame* src, int count)
+  {
+    const int rem = bufferSize - offset;
+    if (count > rem)
+    {
+      Storage::storeBlock(&src->left, &buffer[offset].left, rem * 2);
+      Storage::storeBlock(&src[rem].left, &buffer[0].left, (count - rem) * 2);
+    }
+    else
+    {
+      Storage::storeBlock(&src->left, &buffer[offset].left, count * 2);
+    }
+  }
+
+  bool isDone(int g) const
+  {
+    return slot[g] >= playingCount;
+  }
+
+  int getPlayingCount() const
+  {
+    return playingCount;
+  }
+
+  // the grains that are playing are getPlaying(0) to getPlaying(getPlayingCount() - 1), in no particular order
+  int getPlaying(int i) const
+  {
+    return order[i];
+  }
+
+  // a grain that isn't playing, to be passed to trigger, or -1 when they all are
+  int getFreeGrain() const
+  {
+    return playingCount < capacity ? order[playingCount] : -1;
+  }
+
+  float progress(int g) const
+  {
+    return ramp[g] * phaseScale[g];
+  }
+
+  float envelope(int g) const
+  {
+    return envelope(g, ramp[g]);
+  }
+
+  // how much a grain still has to give: its level now, weighted by how much of it is left to play.
+  // a grain that hasn't started yet counts as being at full level.
+  float remainingLevel(int g) const
+  {
+    const float gain = leftGain[g] > rightGain[g] ? leftGain[g] : rightGain[g];
+    if (preDelay[g])
+    {
+      return gain;
+    }
+    return envelope(g) * (1.0f - progress(g)) * gain;
+  }
+
+  // fades a grain out over the next samples from wherever its envelope is,
+  // so that it can be stopped early without a click.
+  void release(int g, int samples)
+  {
+    // nothing has been heard from it yet
+    if (preDelay[g])
+    {
+      stop(g);
+      return;
+    }
+    const float remaining = samples * speed[g];
+    if (size[g] - ramp[g] > remaining)
+    {
+      size[g] = ramp[g] + remaining;
+      fadeMult[g] = 1.0f / remaining;
+      fading[g] = true;
+    }
+  }
+
+  // all arguments [0,1], relative to buffer size,
+  // env morphs the window from:
+  // expo decay -> Gaussian -> Hann -> Tukey
+  // balance is only left channel at 0, only right channel at 1
+  void trigger(int g, int delay, float end, float length, float rate, float env, float balance, float velocity)
+  {
+    preDelay[g] = delay;
+    ramp[g] = 0;
+    size[g] = length * bufferSize;
+    // we always advance by buffer size
+    // so we don't have to worry about accessing negative indices
+    start[g] = end * bufferSize - size[g] + bufferSize;
+    speed[g] = rate;
+    // convert -1 to 1
+    balance = (balance * 2) - 1;
+    leftGain[g] = (balance < 0  ? 1 : 1.0f - balance) * velocity;
+    rightGain[g] = (balance > 0 ? 1 : 1.0f + balance) * velocity;
+
+    window[g] = windows->get(env);
+    phaseScale[g] = 1.0f / size[g];
+    fading[g] = false;
+    if (isDone(g))
+    {
+      moveTo(g, playingCount++);
+    }
+    stageLength[g][0] = stageLength[g][1] = 0;
+  }
+
+  // writes the sum of every playing grain into left and right
+  void render(FloatArray left, FloatArray right)
+  {
+    const int len = left.getSize();
+    float* outL = left.getData();
+    float* outR = right.getData();
+    memset(outL, 0, len * sizeof(float));
+    memset(outR, 0, len * sizeof(float));
+
+    int group[kGroupSize];
+    int grouped = 0;
+    // backwards, because a grain that ends is swapped with the last playing one, which has been rendered by then
+    for (int i = playingCount - 1; i >= 0; --i)
+    {
+      const int g = order[i];
+      const int skip = min(preDelay[g], len);
+      preDelay[g] -= skip;
+      const int genLen = len - skip;
+      if (!genLen)
+      {
+        continue;
+      }
+
+      bool ends;
+      const int count = prepare(g, genLen, len, ends);
+      if (skip || ends || fading[g] || !src[g])
+      {
+        renderAlone(outL, outR, g, skip, skip + count);
+        finish(g, ends);
+      }
+      else
+      {
+        group[grouped++] = g;
+        if (grouped == kGroupSize)
+        {
+          renderGroup<kGroupSize, true>(outL, outR, group, 0, len);
+          finishGroup(group, grouped);
+          grouped = 0;
+        }
+      }
+    }
+
+    switch (grouped)
+    {
+      case 1: renderGroup<1, true>(outL, outR, group, 0, len); break;
+      case 2: renderGroup<2, true>(outL, outR, group, 0, len); break;
+      case 3: renderGroup<3, true>(outL, outR, group, 0, len); break;
+    }
+    finishGroup(group, grouped);
+  }
+
+  // samples of the buffer a grain reads to generate len samples at speed,
+  // which is every sample it passes over plus the taps either side,
+  // and one more because the start position doesn't fall on a sample.
+  // still at least the taps at slower speeds when len*speed truncates to 0.
+  static int getReadLength(int len, float speed)
+  {
+    return ((int)(len*speed)) + Read::kTaps + 1;
+  }
+
+  // frames each stage of a grain needs, a block at the fastest speed
+  // plus one either side in case the next block starts a frame away from where it was guessed to
+  static int getStageLength(int blockSize, float maxSpeed)
+  {
+    return getReadLength(blockSize, maxSpeed) + 2;
+  }
+
+  // buffer size must be power of two!
+  // the stages are reserved from scratch and should hold getStageLength frames for the fastest speed a grain will play at.
+  static GrainBank* create(RecordFrame* buffer, int bufferSize, ScratchArena* scratch, int stageLength)
+  {
+    return new GrainBank(buffer, bufferSize, scratch, stageLength);
+  }
+
+  static void destroy(GrainBank* bank)
+  {
+    GrainWindows::destroy(bank->windows);
+    delete bank;
+  }
+
+private:
+  // puts grain g at position to in order, swapping it with the grain that was there
+  void moveTo(int g, int to)
+  {
+    const int other = order[to];
+    order[slot[g]] = other;
+    slot[other] = slot[g];
+    order[to] = g;
+    slot[g] = to;
+  }
+
+  void stop(int g)
+  {
+    moveTo(g, --playingCount);
+  }
+
+  float envelope(int g, float r) const
+  {
+    if (fading[g])
+    {
+      return envelopeAt<true>(window[g], r, phaseScale[g], size[g], fadeMult[g]);
+    }
+    return envelopeAt<false>(window[g], r, phaseScale[g], size[g], fadeMult[g]);
+  }
+
+  template<bool fade>
+  static inline float envelopeAt(const float* window, float r, float phaseScale, float size, float fadeMult)
+  {
+    const float env = GrainWindows::read(window, r * phaseScale);
+    if constexpr(fade)
+    {
+      const float level = (size - r) * fadeMult;
+      return env * (level < 1.0f ? level : 1.0f);
+    }
+    return env;
+  }
+
+  // sets up the reads for a grain's block and the fetch for its next one,
+  // returns how many samples it plays this block, and whether it reaches its end on the last of them.
+  int prepare(int g, int genLen, int blockLen, bool& ends)
+  {
+    // samples until ramp reaches the end
+    const float remaining = (size[g] - ramp[g]) / speed[g];
+    int count = (int)remaining;
+    count += count < remaining;
+    count = count < 1 ? 1 : count;
+    ends = count <= genLen;
+    count = ends ? count : genLen;
+
+    first[g] = (int)(start[g] + ramp[g]) - Read::kBefore;
+    origin[g] = start[g] - (float)(first[g] + Read::kBefore);
+    src[g] = stage(g, first[g] & bufferWrapMask, getReadLength(genLen, speed[g]));
+
+    // where the next block will start reading if nothing changes, less the spare frame.
+    // the next block is expected to be the same length as this one, before any delay was skipped.
+    const int next = current[g] ^ 1;
+    const float nextRamp = ramp[g] + speed[g] * genLen;
+    int fetch = 0;
+    if (!ends)
+    {
+      stageOffset[g][next] = ((int)(start[g] + nextRamp) - Read::kBefore - 1) & bufferWrapMask;
+      fetch = getStageLength(blockLen, speed[g]);
+      fetch = fetch > stageCapacity ? 0 : fetch;
+    }
+    stageLength[g][next] = 0;
+    fetchCount[g] = fetch;
+    fetchPerSample[g] = (fetch + genLen - 1) / genLen;
+    fetched[g] = 0;
+    return count;
+  }
+
+  // the current stage if it already holds the readLen frames from offset, or it copies them in now.
+  // returns null when they don't fit, because the grain is playing faster than the stages were sized for.
+  const StageFrame* stage(int g, int offset, int readLen)
+  {
+    StageFrame* data = stageData[g][current[g]];
+    int& offsetOfStage = stageOffset[g][current[g]];
+    int& length = stageLength[g][current[g]];
+    if (length)
+    {
+      const int rel = (offset - offsetOfStage) & bufferWrapMask;
+      if (rel + readLen <= length)
+      {
+        return data + rel;
+      }
+    }
+    if (readLen > stageCapacity)
+    {
+      length = 0;
+      return nullptr;
+    }
+    loadFrames(data, offset, readLen);
+    offsetOfStage = offset;
+    length = readLen;
+    return data;
+  }
+
+  void renderAlone(float* outL, float* outR, int g, int begin, int end)
+  {
+    const bool staged = src[g] != nullptr;
+    if (fading[g])
+    {
+      if (staged)
+      {
+        renderGroup<1, true, true>(outL, outR, &g, begin, end);
+      }
+      else
+      {
+        renderGroup<1, false, true>(outL, outR, &g, begin, end);
+      }
+    }
+    else
+    {
+      if (staged)
+      {
+        renderGroup<1, true, false>(outL, outR, &g, begin, end);
+      }
+      else
+      {
+        renderGroup<1, false, false>(outL, outR, &g, begin, end);
+      }
+    }
+  }
+
+  // converts count frames of the record buffer from offset into a stage, as one or two spans
+  void loadFrames(StageFrame* dst, int offset, int count)
+  {
+    const int rem = bufferSize - offset;
+    if (count > rem)
+    {
+      Storage::loadBlock(&buffer[offset].left, &dst->left, rem * 2);
+      Storage::loadBlock(&buffer[0].left, &dst[rem].left, (count - rem) * 2);
+    }
+    else
+    {
+      Storage::loadBlock(&buffer[offset].left, &dst->left, count * 2);
+    }
+  }
+
+  // renders samples [begin, end) of every grain in ids at once.
+  // everything a grain needs is loaded into locals first so that the lanes can stay in registers.
+  // the envelope is a table read by phase, so there is no branch between attack and decay in here.
+  template<int lanes, bool staged, bool fade = false>
+  void renderGroup(float* outL, float* outR, const int* ids, int begin, int end)
+  {
+    const StageFrame* s[lanes];
+    const float* win[lanes];
+    int firstOf[lanes];
+    float org[lanes], r[lanes], sp[lanes], ps[lanes], sz[lanes], fm[lanes], lg[lanes], rg[lanes];
+    StageFrame* fetchTo[lanes];
+    int fetchFrom[lanes], fetchEnd[lanes], perSample[lanes], f[lanes];
+    for (int k = 0; k < lanes; ++k)
+    {
+      const int g = ids[k];
+      s[k] = src[g];
+      firstOf[k] = first[g];
+      org[k] = origin[g];
+      r[k] = ramp[g];
+      sp[k] = speed[g];
+      win[k] = window[g];
+      ps[k] = phaseScale[g];
+      sz[k] = size[g];
+      fm[k] = fadeMult[g];
+      lg[k] = leftGain[g];
+      rg[k] = rightGain[g];
+      fetchTo[k] = stageData[g][current[g] ^ 1];
+      fetchFrom[k] = stageOffset[g][current[g] ^ 1];
+      fetchEnd[k] = fetchCount[g];
+      perSample[k] = fetchPerSample[g];
+      f[k] = fetched[g];
+    }
+
+    // the end of each segment is where the next one starts
+    float env[lanes], envStep[lanes], envEnd[lanes];
+    for (int k = 0; k < lanes; ++k)
+    {
+      envEnd[k] = envelopeAt<fade>(win[k], r[k], ps[k], sz[k], fm[k]);
+    }
+    for (int i = begin; i < end;)
+    {
+      const int stop = min(i + kSegmentLength, end);
+      const float segment = stop - i;
+      const float segmentScale = stop - i == kSegmentLength ? 1.0f / kSegmentLength : 1.0f / segment;
+      for (int k = 0; k < lanes; ++k)
+      {
+        env[k] = envEnd[k];
+        envEnd[k] = envelopeAt<fade>(win[k], r[k] + sp[k] * segment, ps[k], sz[k], fm[k]);
+        envStep[k] = (envEnd[k] - env[k]) * segmentScale;
+      }
+
+      for (; i < stop; ++i)
+      {
+        float sumL = 0;
+        float sumR = 0;
+        for (int k = 0; k < lanes; ++k)
+        {
+          const float pos = org[k] + r[k];
+          const int idx = (int)pos;
+          float w[Read::kTaps];
+          Read::Kernel::weights(pos - idx, w);
+          float left, right;
+          if constexpr(staged)
+          {
+            const StageFrame* at = s[k] + idx + Read::kBefore;
+            left = Read::gather(&at->left, w);
+            right = Read::gather(&at->right, w);
+          }
+          else
+          {
+            typename RecordRead::Taps taps;
+            taps.index = firstOf[k] + Read::kBefore + idx;
+            memcpy(taps.weights, w, sizeof(w));
+            left = RecordRead::read(&buffer[0].left, bufferWrapMask, taps);
+            right = RecordRead::read(&buffer[0].right, bufferWrapMask, taps);
+          }
+          sumL += left * env[k] * lg[k];
+          sumR += right * env[k] * rg[k];
+          env[k] += envStep[k];
+          r[k] += sp[k];
+        }
+        outL[i] += sumL;
+        outR[i] += sumR;
+      }
+
+      // the copy for the next block, a few frames at a time
+      for (int k = 0; k < lanes; ++k)
+      {
+        const int count = min(perSample[k] * kSegmentLength, fetchEnd[k] - f[k]);
+        loadFrames(fetchTo[k] + f[k], (fetchFrom[k] + f[k]) & bufferWrapMask, count);
+        f[k] += count;
+      }
+    }
+
+    for (int k = 0; k < lanes; ++k)
+    {
+      ramp[ids[k]] = r[k];
+      fetched[ids[k]] = f[k];
+    }
+  }
+
+  // completes the fetch for the next block and swaps stages, or marks the grain done when it ended this block
+  void finish(int g, bool ended)
+  {
+    if (ended)
+    {
+      ramp[g] = size[g];
+      stop(g);
+      return;
+    }
+    const int next = current[g] ^ 1;
+    loadFrames(stageData[g][next] + fetched[g], (stageOffset[g][next] + fetched[g]) & bufferWrapMask, fetchCount[g] - fetched[g]);
+    stageLength[g][next] = fetchCount[g];
+    current[g] = next;
+  }
+
+  void finishGroup(const int* ids, int count)
+  {
+    for (int k = 0; k < count; ++k)
+    {
+      finish(ids[k], false);
+    }
+  }
+};
@@ -0,0 +1,161 @@
+#pragma once
+#ifndef __GRAIN_SCHEDULER_H__
+#define __GRAIN_SCHEDULER_H__
+
+#include <math.h>
+#include "basicmaths.h"
+
+// Works out the sample offsets within a block that grains start at,
+// so a granulator only visits those samples instead of testing every one.
+// Steady spawns are a fixed spacing apart, random ones have exponentially distributed gaps
+// with the same mean, which is what a chance of spawning on every sample tends to.
+// The gap is worked out again from the interval every block, so a change of density applies to the wait in progress.
+// External triggers are queued at their offset in the block.
+class GrainScheduler
+{
+public:
+  static const int MAX_QUEUED = 8;
+
+private:
+  float interval;
+  bool random;
+  // offset of the last scheduled spawn relative to the start of the block, negative when it was in an earlier block
+  float lastSpawn;
+  // gap to the next spawn in intervals, 1 when steady
+  float gapScale;
+  int queued[MAX_QUEUED];
+  int queuedCount;
+  // a spawn that couldn't start, it happens at the start of the next block
+  bool pending;
+  // set once a spawn has been put off until the next block, so nothing else starts in this one
+  bool deferred;
+
+  static float drawGap()
+  {
+    return -logf(1.0f - randf() * 0.9999f);
+  }
+
+public:
+  GrainScheduler()
+    : interval(0), random(false), lastSpawn(0), gapScale(1), queuedCount(0), pending(false), deferred(false)
+  {
+  }
+
+  // mean samples between spawns, infinite for none
+  void setSteady(float spacing)
+  {
+    if (random)
+    {
+      random = false;
+      gapScale = 1;
+    }
+    interval = spacing;
+  }
+
+  void setRandom(float meanInterval)
+  {
+    if (!random)
+    {
+      random = true;
+      gapScale = drawGap();
+    }
+    interval = meanInterval;
+  }
+
+  bool isRandom() const
+  {
+    return random;
+  }
+
+  // a trigger at an offset into the block about to be processed, they are dropped if too many arrive in one block
+  void trigger(int offset)
+  {
+    if (queuedCount == MAX_QUEUED)
+    {
+      return;
+    }
+    int i = queuedCount++;
+    for (; i > 0 && queued[i - 1] > offset; --i)
+    {
+      queued[i] = queued[i - 1];
+    }
+    queued[i] = offset;
+  }
+
+  // the next spawn in a block of len samples, or len when there are no more.
+  // triggered says whether it is an external trigger.
+  int next(int len, bool& triggered) const
+  {
+    if (deferred)
+    {
+      triggered = false;
+      return len;
+    }
+    int scheduled = len;
+    if (pending)
+    {
+      scheduled = 0;
+    }
+    else
+    {
+      // never more than one spawn on a sample
+      const float at = lastSpawn + max(interval * gapScale, 1.0f);
+      if (at < len)
+      {
+        scheduled = at > 0 ? (int)ceilf(at) : 0;
+      }
+    }
+    const int trig = queuedCount ? min(queued[0], len - 1) : len;
+    triggered = trig < scheduled;
+    return triggered ? trig : scheduled;
+  }
+
+  // the spawn returned by next has been handled, whether or not a grain started for it
+  void take(int offset, bool triggered)
+  {
+    if (triggered)
+    {
+      --queuedCount;
+      for (int i = 0; i < queuedCount; ++i)
+      {
+        queued[i] = queued[i + 1];
+      }
+      // a trigger restarts the wait for the next steady spawn
+      if (random)
+      {
+        return;
+      }
+    }
+    else if (random)
+    {
+      gapScale = drawGap();
+    }
+    pending = false;
+    lastSpawn = offset;
+  }
+
+  // there was no grain for the spawn returned by next, so it and everything after it waits for the next block
+  void defer(bool triggered)
+  {
+    if (!triggered)
+    {
+      pending = true;
+    }
+    deferred = true;
+  }
+
+  // moves on to the next block, after all of this block's spawns have been taken
+  void advance(int len)
+  {
+    // triggers still queued were put off, so they are due straight away
+    for (int i = 0; i < queuedCount; ++i)
+    {
+      queued[i] = 0;
+    }
+    // far enough back that it makes no difference, without losing precision
+    lastSpawn = max(lastSpawn - len, -1e9f);
+    deferred = false;
+  }
+};
+
+#endif // __GRAIN_SCHEDULER_H__
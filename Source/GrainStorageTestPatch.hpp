@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Patch.h"
+#include "GrainBank.hpp"
+
+// Compares the cost of playing grains from a float record buffer and a short one stored like the Grainz record buffer.
+// Both record the same input and play the same grains every block, parameter A picks which one is heard.
+class GrainStorageTestPatch : public Patch
+{
+  static const int GRAIN_COUNT = 32;
+  static const int RECORD_SIZE = 1 << 19;
+
+  typedef GrainBank<GRAIN_COUNT, float> FloatGrains;
+  typedef GrainBank<GRAIN_COUNT, FullScaleShort> ShortGrains;
+
+  FloatGrains::RecordFrame* floatRecord;
+  ShortGrains::RecordFrame* shortRecord;
+  FloatGrains* floatGrains;
+  ShortGrains* shortGrains;
+  ScratchArena* scratch;
+  int writeIndex;
+
+public:
+  GrainStorageTestPatch() : Patch(), writeIndex(0)
+  {
+    const int stageLength = FloatGrains::getStageLength(getBlockSize(), 4);
+    const size_t stageBytes = (stageLength * sizeof(FloatGrains::StageFrame) + 7) & ~7;
+    scratch = ScratchArena::create(getBlockSize() * 2 * sizeof(float) + stageBytes * 4 * GRAIN_COUNT + 16);
+    floatRecord = new FloatGrains::RecordFrame[RECORD_SIZE];
+    shortRecord = new ShortGrains::RecordFrame[RECORD_SIZE];
+    memset(floatRecord, 0, RECORD_SIZE * sizeof(FloatGrains::RecordFrame));
+    memset(shortRecord, 0, RECORD_SIZE * sizeof(ShortGrains::RecordFrame));
+    floatGrains = FloatGrains::create(floatRecord, RECORD_SIZE, scratch, stageLength);
+    shortGrains = ShortGrains::create(shortRecord, RECORD_SIZE, scratch, stageLength);
+
+    registerParameter(PARAMETER_A, "Storage");
+    registerParameter(PARAMETER_B, "Speed");
+    registerParameter(PARAMETER_F, "Float CPU>>");
+    registerParameter(PARAMETER_G, "Short CPU>>");
+  }
+
+  ~GrainStorageTestPatch()
+  {
+    FloatGrains::destroy(floatGrains);
+    ShortGrains::destroy(shortGrains);
+    ScratchArena::destroy(scratch);
+    delete[] floatRecord;
+    delete[] shortRecord;
+  }
+
+  // returns CPU% as [0,1] value
+  float getElapsedTime()
+  {
+    return getElapsedCycles() / getBlockSize() / 10000.0f;
+  }
+
+  void processAudio(AudioBuffer& audio) override
+  {
+    scratch->reset();
+    const int size = audio.getSize();
+    FloatArray left = audio.getSamples(0);
+    FloatArray right = audio.getSamples(1);
+    FloatArray shortLeft = scratch->allocateFloats(size);
+    FloatArray shortRight = scratch->allocateFloats(size);
+
+    for (int i = 0; i < size; ++i)
+    {
+      floatRecord[writeIndex] = FloatGrains::makeFrame(left[i], right[i]);
+      shortRecord[writeIndex] = ShortGrains::makeFrame(left[i], right[i]);
+      writeIndex = (writeIndex + 1) & (RECORD_SIZE - 1);
+    }
+
+    // keep every grain playing, each one a second long starting somewhere in the last few seconds
+    const float speed = 0.25f + getParameterValue(PARAMETER_B) * 3.75f;
+    for (int g = 0; g < GRAIN_COUNT; ++g)
+    {
+      if (floatGrains->isDone(g))
+      {
+        const float end = (float)writeIndex / RECORD_SIZE - randf() * 0.25f;
+        const float length = getSampleRate() / RECORD_SIZE;
+        const float pan = randf();
+        floatGrains->trigger(g, 0, end, length, speed, 0.5f, pan, 1);
+        shortGrains->trigger(g, 0, end, length, speed, 0.5f, pan, 1);
+      }
+    }
+
+    float time = getElapsedTime();
+    floatGrains->render(left, right);
+    float floatTime = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    shortGrains->render(shortLeft, shortRight);
+    float shortTime = getElapsedTime() - time;
+
+    if (getParameterValue(PARAMETER_A) > 0.5f)
+    {
+      shortLeft.copyTo(left);
+      shortRight.copyTo(right);
+    }
+    left.multiply(0.125f);
+    right.multiply(0.125f);
+
+    setParameterValue(PARAMETER_F, floatTime);
+    setParameterValue(PARAMETER_G, shortTime);
+  }
+};
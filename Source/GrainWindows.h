@@ -0,0 +1,117 @@
+#pragma once
+#ifndef __GRAIN_WINDOWS_H__
+#define __GRAIN_WINDOWS_H__
+
+#include <math.h>
+
+// Grain window shapes as tables, read by phase with linear interpolation.
+// A morph amount moves from expo decay to Gaussian to Hann to Tukey,
+// and the shapes in between are worked out into tables of their own once,
+// so a grain picks one table when it starts and only ever reads that.
+class GrainWindows
+{
+public:
+  static constexpr int kTableSize = 256;
+  // tables from one shape to the next
+  static constexpr int kMorphSteps = 8;
+  static constexpr int kShapes = 4;
+  static constexpr int kTables = (kShapes - 1) * kMorphSteps + 1;
+
+private:
+  // each table has a point at phase 1 and a zero after it, so that a read at 1 still has a next point
+  static constexpr int kTableStride = kTableSize + 2;
+
+  float* tables;
+
+  GrainWindows(float* tables) : tables(tables)
+  {
+    for (int t = 0; t < kTables; ++t)
+    {
+      const int from = t / kMorphSteps;
+      const float mix = (float)(t % kMorphSteps) / kMorphSteps;
+      float* table = tables + t * kTableStride;
+      for (int i = 0; i <= kTableSize; ++i)
+      {
+        const float phase = (float)i / kTableSize;
+        const float a = shape(from, phase);
+        table[i] = mix > 0 ? a + mix * (shape(from + 1, phase) - a) : a;
+      }
+      table[kTableSize + 1] = 0;
+    }
+  }
+
+  // all of them are 0 at phase 0 and 1, and peak at 1
+  static float shape(int index, float phase)
+  {
+    switch (index)
+    {
+      // quick raised cosine attack and an exponential tail
+      case 0:
+      {
+        const float attack = 0.05f;
+        if (phase < attack)
+        {
+          return 0.5f - 0.5f * cosf(M_PI * phase / attack);
+        }
+        const float k = 6.0f;
+        const float floor = expf(-k);
+        return (expf(-k * (phase - attack) / (1.0f - attack)) - floor) / (1.0f - floor);
+      }
+      // Gaussian with its edges pulled down to 0
+      case 1:
+      {
+        const float sigma = 0.15f;
+        const float x = (phase - 0.5f) / sigma;
+        const float edge = expf(-0.5f * (0.5f / sigma) * (0.5f / sigma));
+        return (expf(-0.5f * x * x) - edge) / (1.0f - edge);
+      }
+      // Hann
+      case 2:
+        return 0.5f - 0.5f * cosf(2 * M_PI * phase);
+      // Tukey, cosine tapers on the first and last quarter
+      default:
+      {
+        const float taper = 0.25f;
+        if (phase < taper)
+        {
+          return 0.5f - 0.5f * cosf(M_PI * phase / taper);
+        }
+        if (phase > 1.0f - taper)
+        {
+          return 0.5f - 0.5f * cosf(M_PI * (1.0f - phase) / taper);
+        }
+        return 1.0f;
+      }
+    }
+  }
+
+public:
+  // the table nearest to morph, which is [0,1]
+  const float* get(float morph) const
+  {
+    morph = morph < 0 ? 0 : morph > 1 ? 1 : morph;
+    return tables + (int)(morph * (kTables - 1) + 0.5f) * kTableStride;
+  }
+
+  // phase is [0,1], anything past 1 reads the end of the table,
+  // for a grain that goes a sample past its end before it stops.
+  static inline float read(const float* table, float phase)
+  {
+    const float x = (phase < 1.0f ? phase : 1.0f) * kTableSize;
+    const int i = (int)x;
+    return table[i] + (x - i) * (table[i + 1] - table[i]);
+  }
+
+  static GrainWindows* create()
+  {
+    return new GrainWindows(new float[kTables * kTableStride]);
+  }
+
+  static void destroy(GrainWindows* windows)
+  {
+    delete[] windows->tables;
+    delete windows;
+  }
+};
+
+#endif // __GRAIN_WINDOWS_H__
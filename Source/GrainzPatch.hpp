@@ -5,7 +5,9 @@
 #include "CircularBuffer.h"
 #include "VoltsPerOctave.h"
 #include "BiquadFilter.h"
-#include "Grain.hpp"
+#include "GrainBank.hpp"
+#include "GrainScheduler.h"
+#include "ScratchArena.h"
 #include "custom_dsp.h" // for SoftLimit
 
 //#define PROFILE
@@ -16,11 +18,17 @@
 
 using namespace daisysp;
 
-// TODO: want more grains, but not sure how much more optimizing can be done
-static const int MAX_GRAINS = 24;
+// size of the grain pool, how many of them play at once is limited by CPU_BUDGET
+static const int MAX_GRAINS = 64;
+// fraction of the block time the patch aims to use
+static const float CPU_BUDGET = 0.8f;
+// samples a grain fades out over when it is stopped early to make room for a new one
+static const int STEAL_RELEASE = 128;
 // must be power of two
 static const int RECORD_BUFFER_SIZE = 1 << 19; // approx 11 seconds at 48k
 static const int RECORD_BUFFER_WRAP = RECORD_BUFFER_SIZE - 1;
+// level above which what is recorded is soft clipped, about -2.5 dBFS
+static const float RECORD_CLIP_KNEE = 0.75f;
 
 class GrainzPatch : public Patch
 {
@@ -47,17 +55,26 @@ class GrainzPatch : public Patch
   StereoDcBlockingFilter* dcFilter;
   VoltsPerOctave voct;
 
-  Sample* recordBuffer;
+  // the record buffer is kept as full scale shorts, which is 2 MB instead of 4.
+  // what is recorded is soft clipped so it never goes past full scale.
+  typedef GrainBank<MAX_GRAINS, FullScaleShort> Grains;
+
+  Grains::RecordFrame* recordBuffer;
   int recordWriteIndex;
 
-  Grain* grains[MAX_GRAINS];
-  int availableGrains[MAX_GRAINS];
+  Grains* grains;
   int activeGrains;
+  // how many grains fit in the CPU budget, worked out from the measured cost of rendering them
+  float voiceLimit;
+  // fractions of the block time, averaged over recent blocks
+  float grainCost;
+  float otherCost;
+  // grain fading out to make room, -1 when there isn't one
+  int stealing;
   uint16_t  freeze;
-  AudioBuffer* grainBuffer;
-  float grainRatePhasor;
-  bool grainTriggered;
-  float grainTriggerDelay;
+  // temporaries for one block: the grain mix, with the grains' staging memory reserved below them
+  ScratchArena* scratch;
+  GrainScheduler scheduler;
 
   // these are expressed as a percentage of the total buffer size
   const float minGrainSize;
@@ -66,6 +83,7 @@ class GrainzPatch : public Patch
   const int playedGateSampleLength;
   int   playedGate;
 
+  // grain output from the previous block, so not scratch
   AudioBuffer* feedbackBuffer;
   BiquadFilter* feedbackFilterLeft;
   BiquadFilter* feedbackFilterRight;
@@ -83,12 +101,12 @@ class GrainzPatch : public Patch
 
 public:
   GrainzPatch()
-    : recordBuffer(0), recordWriteIndex(0), grainBuffer(0)
-    , grainRatePhasor(0), grainTriggered(false), activeGrains(0), freeze(OFF)
+    : voct(-0.5f, 4), recordBuffer(0), recordWriteIndex(0)
+    , activeGrains(0), voiceLimit(MAX_GRAINS), grainCost(0), otherCost(0), stealing(-1)
+    , freeze(OFF), scratch(0)
     , minGrainSize(getSampleRate()*0.008f / RECORD_BUFFER_SIZE) // 8ms
     , maxGrainSize(getSampleRate()*1.0f / RECORD_BUFFER_SIZE) // 1 second
     , playedGateSampleLength(10 * getSampleRate() / 1000), playedGate(0)
-    , voct(-0.5f, 4)
   {
     norms[0] = 1;
     for (int i = 1; i < MAX_GRAINS + 1; i++) {
@@ -100,13 +118,17 @@ public:
     feedbackFilterRight = BiquadFilter::create(getSampleRate());
     feedbackBuffer = AudioBuffer::create(2, getBlockSize());
 
-    recordBuffer = new Sample[RECORD_BUFFER_SIZE];
-    grainBuffer = AudioBuffer::create(2, getBlockSize());
+    // room for the stereo grain mix and the frames being recorded, plus the two stages every grain reads the record buffer through,
+    // each a block's worth at the fastest speed.
+    // allocated before the record buffer so that it comes from internal RAM rather than SDRAM.
+    const float maxGrainSpeed = voct.getFrequency(1.0f) / 440.0f;
+    const int stageLength = Grains::getStageLength(getBlockSize(), maxGrainSpeed);
+    const size_t stageBytes = (stageLength * sizeof(Grains::StageFrame) + 7) & ~7;
+    scratch = ScratchArena::create(getBlockSize() * 4 * sizeof(float) + stageBytes * 2 * MAX_GRAINS + 16);
 
-    for (int i = 0; i < MAX_GRAINS; ++i)
-    {
-      grains[i] = Grain::create(recordBuffer, RECORD_BUFFER_SIZE);
-    }
+    recordBuffer = new Grains::RecordFrame[RECORD_BUFFER_SIZE];
+
+    grains = Grains::create(recordBuffer, RECORD_BUFFER_SIZE, scratch, stageLength);
 
     registerParameter(inPosition, "Position");
     registerParameter(inSize, "Size");
@@ -120,7 +142,7 @@ public:
     registerParameter(outGrainPlayback, "Playback>");
     registerParameter(outGrainEnvelope, "Envelope>");
 
-    // default to triangle window
+    // default to a window halfway between Gaussian and Hann
     setParameterValue(inEnvelope, 0.5f);
     setParameterValue(inSpread, 0);
     setParameterValue(inVelocity, 0);
@@ -135,22 +157,18 @@ public:
     BiquadFilter::destroy(feedbackFilterLeft);
     BiquadFilter::destroy(feedbackFilterRight);
     AudioBuffer::destroy(feedbackBuffer);
-    AudioBuffer::destroy(grainBuffer);
+    ScratchArena::destroy(scratch);
 
     delete[] recordBuffer;
 
-    for (int i = 0; i < MAX_GRAINS; i+=2)
-    {
-      Grain::destroy(grains[i]);
-    }
+    Grains::destroy(grains);
   }
 
   void buttonChanged(PatchButtonId bid, uint16_t value, uint16_t samples) override
   {
     if (bid == inTrigger && value == ON)
     {
-      grainTriggerDelay = samples;
-      grainTriggered = true;
+      scheduler.trigger(samples);
     }
     else if (bid == inFreeze && value == ON)
     {
@@ -164,13 +182,14 @@ public:
     char debugMsg[64];
     char* debugCpy = stpcpy(debugMsg, "blk ");
     debugCpy = stpcpy(debugCpy, msg_itoa(audio.getSize(), 10));
-    const float processStart = getElapsedBlockTime();
 #endif
+    const float processStart = getElapsedBlockTime();
+    scratch->reset();
     const int size = audio.getSize();
     FloatArray inOutLeft = audio.getSamples(0);
     FloatArray inOutRight = audio.getSamples(1);
-    FloatArray grainLeft = grainBuffer->getSamples(0);
-    FloatArray grainRight = grainBuffer->getSamples(1);
+    FloatArray grainLeft = scratch->allocateFloats(size);
+    FloatArray grainRight = scratch->allocateFloats(size);
     FloatArray feedLeft = feedbackBuffer->getSamples(0);
     FloatArray feedRight = feedbackBuffer->getSamples(1);
 
@@ -210,89 +229,78 @@ public:
       feedbackFilterLeft->process(feedLeft);
       feedbackFilterRight->setHighPass(cutoff, 1);
       feedbackFilterRight->process(feedRight);
-      float softLimitCoeff = feedback * 1.4f;
-      for (int i = 0; i < size; ++i)
-      {
-        float left = inOutLeft[i];
-        float right = inOutRight[i];
-        left += feedback * (SoftLimit(softLimitCoeff * feedLeft[i] + left) - left);
-        right += feedback * (SoftLimit(softLimitCoeff * feedRight[i] + right) - right);
-        recordBuffer[recordWriteIndex] = Sample(left*FloatToSample, right*FloatToSample);
-        recordWriteIndex = (recordWriteIndex + 1) & RECORD_BUFFER_WRAP;
-      }
+      Grains::StageFrame* frames = scratch->allocate<Grains::StageFrame>(size);
+      mixFeedback(frames, inOutLeft.getData(), inOutRight.getData(), feedLeft.getData(), feedRight.getData(), size, feedback);
+      grains->write(recordWriteIndex, frames, size);
+      recordWriteIndex = (recordWriteIndex + size) & RECORD_BUFFER_WRAP;
     }
 
+    // density is relative to the grains we can afford, so it comes down smoothly with the budget
+    const int grainLimit = (int)voiceLimit;
     float grainSampleLength = (grainSize*RECORD_BUFFER_SIZE);
-    float targetGrains = MAX_GRAINS * grainOverlap;
-    float grainProb = targetGrains / grainSampleLength;
+    float targetGrains = voiceLimit * grainOverlap;
     float grainSpacing = grainSampleLength / targetGrains;
 
     if (grainDensity < 0.5f)
     {
-      grainProb = -1.0f;
+      scheduler.setSteady(grainSpacing);
     }
     else
     {
-      grainRatePhasor = -getBlockSize();
+      scheduler.setRandom(grainSpacing);
     }
 
-    int numAvailableGrains = updateAvailableGrains();
+    if (stealing >= 0 && grains->isDone(stealing))
+    {
+      stealing = -1;
+    }
+    // when the budget shrinks, grains are faded out one at a time until we are back under it
+    if (grains->getPlayingCount() > grainLimit)
+    {
+      stealGrain();
+    }
     const int readIdx = recordWriteIndex - size;
-    for (int i = 0; i < size; ++i)
+    bool triggered;
+    for (int i = scheduler.next(size, triggered); i < size; i = scheduler.next(size, triggered))
     {
-      grainRatePhasor += 1.0f;
-      bool startProb = randf() < grainProb && targetGrains > activeGrains;
-      bool startSteady = grainRatePhasor >= grainSpacing;
-      bool startGrain = startProb || startSteady || grainTriggered;
-      if (startGrain && numAvailableGrains)
+      // random spawns hold off while there are already as many grains as density asks for
+      if (!triggered && scheduler.isRandom() && targetGrains <= activeGrains)
+      {
+        scheduler.take(i, triggered);
+      }
+      else if (grains->getPlayingCount() >= grainLimit || grains->getFreeGrain() < 0)
+      {
+        // the grain starts once the one being stolen has faded out, which is usually the next block
+        stealGrain();
+        scheduler.defer(triggered);
+      }
+      else
       {
-        --numAvailableGrains;
-        int gidx = availableGrains[numAvailableGrains];
-        Grain* g = grains[gidx];
-        float grainDelay = i > grainTriggerDelay ? i : grainTriggerDelay;
+        scheduler.take(i, triggered);
+        int gidx = grains->getFreeGrain();
         int head = readIdx + i;
         float grainEndPos = (float)head / RECORD_BUFFER_SIZE;
         float pan = 0.5f + (randf() - 0.5f)*grainSpread;
         float vel = 1.0f + (randf() * 2 - 1.0f)*grainVelocity;
-        g->trigger(grainDelay, grainEndPos - grainPosition, grainSize, grainSpeed, grainEnvelope, pan, vel);
-        grainTriggered = false;
-        grainTriggerDelay = 0;
-        grainRatePhasor = 0;
+        grains->trigger(gidx, i, grainEndPos - grainPosition, grainSize, grainSpeed, grainEnvelope, pan, vel);
         playedGate = playedGateSampleLength;
       }
     }
+    scheduler.advance(size);
 
-#ifdef PROFILE
     const float genStart = getElapsedBlockTime();
-#endif
     float avgProgress = 0;
     float avgEnvelope = 0;
     int prevActiveGrains = activeGrains;
-    activeGrains = 0;
-    bool clear = true;
+    activeGrains = grains->getPlayingCount();
 
-    for (int gi = 0; gi < MAX_GRAINS; ++gi)
+    for (int i = 0; i < activeGrains; ++i)
     {
-      auto g = grains[gi];
-
-      if (!g->isDone)
-      {
-        avgEnvelope += g->envelope();
-        avgProgress += g->progress();
-        ++activeGrains;
-        if (clear) {
-          g->generate<true>(grainLeft, grainRight, size);
-          clear = false;
-        }
-        else {
-          g->generate<false>(grainLeft, grainRight, size);
-        }
-      }
-    }
-    if (clear) {
-      grainLeft.clear();
-      grainRight.clear();
+      const int gi = grains->getPlaying(i);
+      avgEnvelope += grains->envelope(gi);
+      avgProgress += grains->progress(gi);
     }
+    grains->render(grainLeft, grainRight);
     float fromGainAdjust = norms[prevActiveGrains];
     float toGainAdjust = norms[activeGrains];
     grainLeft.scale(fromGainAdjust, toGainAdjust);
@@ -305,8 +313,8 @@ public:
       avgEnvelope /= activeGrains;
       avgProgress /= activeGrains;
     }
-#ifdef PROFILE
     const float genTime = getElapsedBlockTime() - genStart;
+#ifdef PROFILE
     debugCpy = stpcpy(debugCpy, " gen(");
     debugCpy = stpcpy(debugCpy, msg_itoa(activeGrains, 10));
     debugCpy = stpcpy(debugCpy, ") ");
@@ -326,25 +334,78 @@ public:
     setParameterValue(outGrainPlayback, avgProgress);
     setParameterValue(outGrainEnvelope, avgEnvelope);
 
-#ifdef PROFILE
     const float processTime = getElapsedBlockTime() - processStart - genTime;
+    updateVoiceLimit(genTime, processTime);
+
+#ifdef PROFILE
     debugCpy = stpcpy(debugCpy, " proc ");
     debugCpy = stpcpy(debugCpy, msg_itoa((int)(processTime * 1000), 10));
     debugMessage(debugMsg);
 #endif
   }
 private:
+  // the input with the soft limited feedback mixed in, soft clipped and interleaved into frames ready to be written to the record buffer.
+  // both channels are worked out in the same iteration, with nothing in the loop but the arithmetic,
+  // so the compiler can interleave them and keep amount and the limit coefficient in registers.
+  static void mixFeedback(Grains::StageFrame* __restrict frames, const float* __restrict inLeft, const float* __restrict inRight,
+                          const float* __restrict feedLeft, const float* __restrict feedRight, const int size, const float amount)
+  {
+    const float softLimitCoeff = amount * 1.4f;
+    for (int i = 0; i < size; ++i)
+    {
+      const float left = inLeft[i];
+      const float right = inRight[i];
+      frames[i].left = softClip(left + amount * (SoftLimit(softLimitCoeff * feedLeft[i] + left) - left));
+      frames[i].right = softClip(right + amount * (SoftLimit(softLimitCoeff * feedRight[i] + right) - right));
+    }
+  }
 
-  int updateAvailableGrains()
+  // leaves the signal alone up to the knee and bends it smoothly towards full scale past it,
+  // so loud input fills the record buffer's 16 bits without hard clipping.
+  static inline float softClip(float x)
   {
-    int count = 0;
-    for (int gi = 0; gi < MAX_GRAINS; ++gi)
+    const float mag = x < 0 ? -x : x;
+    if (mag <= RECORD_CLIP_KNEE)
     {
-      if (grains[gi]->isDone)
+      return x;
+    }
+    const float over = (mag - RECORD_CLIP_KNEE) / (1.0f - RECORD_CLIP_KNEE);
+    const float y = RECORD_CLIP_KNEE + (1.0f - RECORD_CLIP_KNEE) * over / (1.0f + over);
+    return x < 0 ? -y : y;
+  }
+
+  void updateVoiceLimit(float genTime, float processTime)
+  {
+    otherCost += (processTime - otherCost) * 0.1f;
+    if (activeGrains > 0)
+    {
+      grainCost += (genTime / activeGrains - grainCost) * 0.1f;
+    }
+    const float affordable = grainCost > 0 ? (CPU_BUDGET - otherCost) / grainCost : MAX_GRAINS;
+    voiceLimit += (clamp(affordable, 1.0f, (float)MAX_GRAINS) - voiceLimit) * 0.05f;
+  }
+
+  // fades out the grain that will be missed the least, unless one is already fading
+  void stealGrain()
+  {
+    if (stealing >= 0)
+    {
+      return;
+    }
+    float lowest = 0;
+    for (int i = 0; i < grains->getPlayingCount(); ++i)
+    {
+      const int gi = grains->getPlaying(i);
+      const float level = grains->remainingLevel(gi);
+      if (stealing < 0 || level < lowest)
       {
-        availableGrains[count++] = gi;
+        stealing = gi;
+        lowest = level;
       }
     }
-    return count;
+    if (stealing >= 0)
+    {
+      grains->release(stealing, STEAL_RELEASE);
+    }
   }
 };
@@ -0,0 +1,332 @@
+#pragma once
+#ifndef __INTERPOLATED_READ_H__
+#define __INTERPOLATED_READ_H__
+
+// Fractional reads from power of two sized circular buffers at a choice of quality.
+// The quality is a template argument, so each call site only pays for the kernel it asks for.
+// A kernel turns the fractional part of a position into one weight per tap,
+// so the weights can be worked out once and applied to more than one channel.
+// Every kernel is symmetric about the point between its two middle taps,
+// which lets a read at a delay behind a write index gather its taps backwards with the same weights.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "DelayStorage.h"
+
+enum class InterpolationQuality : uint8_t
+{
+  // 2 taps
+  Linear,
+  // 4 point, 3rd order (Catmull-Rom)
+  Hermite,
+  // 6 point, 5th order
+  Lagrange,
+  // 8 point Blackman windowed sinc from a table of phases
+  Sinc
+};
+
+// kBefore is how many of the taps come before the sample at t = 0.
+// prepare works out anything a kernel needs before weights can be called,
+// it has to be called off the audio thread, e.g. in a constructor, and only the sinc table does anything in it.
+template<InterpolationQuality quality>
+struct InterpolationKernel;
+
+template<>
+struct InterpolationKernel<InterpolationQuality::Linear>
+{
+  static constexpr int kTaps = 2;
+  static constexpr int kBefore = 0;
+
+  static void prepare() {}
+
+  static inline void weights(float t, float* w)
+  {
+    w[0] = 1.0f - t;
+    w[1] = t;
+  }
+};
+
+template<>
+struct InterpolationKernel<InterpolationQuality::Hermite>
+{
+  static constexpr int kTaps = 4;
+  static constexpr int kBefore = 1;
+
+  static void prepare() {}
+
+  static inline void weights(float t, float* w)
+  {
+    const float t2 = t * t;
+    w[0] = ((-0.5f * t + 1.0f) * t - 0.5f) * t;
+    w[1] = (1.5f * t - 2.5f) * t2 + 1.0f;
+    w[2] = ((-1.5f * t + 2.0f) * t + 0.5f) * t;
+    w[3] = (0.5f * t - 0.5f) * t2;
+  }
+};
+
+template<>
+struct InterpolationKernel<InterpolationQuality::Lagrange>
+{
+  static constexpr int kTaps = 6;
+  static constexpr int kBefore = 2;
+
+  static void prepare() {}
+
+  // the Lagrange basis for taps at -2..3, built from running products of (t - j) from each end
+  static inline void weights(float t, float* w)
+  {
+    const float a = t + 2.0f;
+    const float b = t + 1.0f;
+    const float d = t - 1.0f;
+    const float e = t - 2.0f;
+    const float f = t - 3.0f;
+    const float ab = a * b;
+    const float abc = ab * t;
+    const float abcd = abc * d;
+    const float ef = e * f;
+    const float def = d * ef;
+    const float cdef = t * def;
+    w[0] = b * cdef * (-1.0f / 120.0f);
+    w[1] = a * cdef * (1.0f / 24.0f);
+    w[2] = ab * def * (-1.0f / 12.0f);
+    w[3] = abc * ef * (1.0f / 12.0f);
+    w[4] = abcd * f * (-1.0f / 24.0f);
+    w[5] = abcd * e * (1.0f / 120.0f);
+  }
+};
+
+template<>
+struct InterpolationKernel<InterpolationQuality::Sinc>
+{
+  static constexpr int kTaps = 8;
+  static constexpr int kBefore = 3;
+  // weights in between two phases of the table are linearly interpolated
+  static constexpr int kPhases = 128;
+
+  static inline void weights(float t, float* w)
+  {
+    const float* table = getTable();
+    const float phase = t * kPhases;
+    const int p = (int)phase;
+    const float f = phase - p;
+    const float* lo = table + p * kTaps;
+    const float* hi = lo + kTaps;
+    for (int k = 0; k < kTaps; ++k)
+    {
+      w[k] = lo[k] + f * (hi[k] - lo[k]);
+    }
+  }
+
+  // fills the table, it only does any work the first time
+  static void prepare()
+  {
+    static bool filled = false;
+    if (filled)
+    {
+      return;
+    }
+    float* table = getTable();
+    for (int p = 0; p <= kPhases; ++p)
+    {
+      float* row = table + p * kTaps;
+      float sum = 0;
+      for (int k = 0; k < kTaps; ++k)
+      {
+        const float x = (float)(k - kBefore) - (float)p / kPhases;
+        const float sinc = x == 0 ? 1.0f : sinf(M_PI * x) / (M_PI * x);
+        // Blackman window over [-kTaps/2, kTaps/2]
+        const float u = x / kTaps + 0.5f;
+        const float window = 0.42f - 0.5f * cosf(2 * M_PI * u) + 0.08f * cosf(4 * M_PI * u);
+        row[k] = sinc * window;
+        sum += row[k];
+      }
+      for (int k = 0; k < kTaps; ++k)
+      {
+        row[k] /= sum;
+      }
+    }
+    filled = true;
+  }
+
+private:
+  // kPhases + 1 rows of kTaps weights, filled by prepare.
+  // each row is normalised to sum to one so there is no ripple in the level of DC.
+  static float* getTable()
+  {
+    static float table[(kPhases + 1) * kTaps];
+    return table;
+  }
+};
+
+// T is the type the buffer holds, converted with DelayStorage<T>::load.
+// stride is the distance between samples, so one channel of interleaved frames can be read.
+// Positions and indices are in samples and masked with mask, which is the buffer size minus one.
+template<InterpolationQuality quality, typename T = float, int stride = 1>
+class InterpolatedRead
+{
+  using Storage = DelayStorage<T>;
+
+public:
+  using Kernel = InterpolationKernel<quality>;
+  static constexpr int kTaps = Kernel::kTaps;
+  static constexpr int kBefore = Kernel::kBefore;
+  static constexpr int kAfter = kTaps - 1 - kBefore;
+
+  // call before reading from the audio thread, see InterpolationKernel
+  static void prepare()
+  {
+    Kernel::prepare();
+  }
+
+  // where to read and with what weights, for when several channels are read at the same position
+  struct Taps
+  {
+    size_t index;
+    float weights[kTaps];
+  };
+
+  // position counts forwards through the buffer and must not be negative
+  static inline Taps at(float position)
+  {
+    Taps taps;
+    taps.index = (size_t)position;
+    Kernel::weights(position - taps.index, taps.weights);
+    return taps;
+  }
+
+  static inline float read(const T* buf, size_t mask, const Taps& taps)
+  {
+    const size_t first = taps.index - kBefore;
+    float sum = 0;
+    for (int k = 0; k < kTaps; ++k)
+    {
+      sum += Storage::load(buf[((first + k) & mask) * stride]) * taps.weights[k];
+    }
+    return sum;
+  }
+
+  static inline float read(const T* buf, size_t mask, float position)
+  {
+    return read(buf, mask, at(position));
+  }
+
+  // reads from memory that holds every tap without wrapping, sample points at the sample at t = 0
+  static inline float gather(const T* sample, const float* weights)
+  {
+    const T* first = sample - kBefore * stride;
+    float sum = 0;
+    for (int k = 0; k < kTaps; ++k)
+    {
+      sum += Storage::load(first[k * stride]) * weights[k];
+    }
+    return sum;
+  }
+
+  static inline float gather(const T* sample, float t)
+  {
+    float w[kTaps];
+    Kernel::weights(t, w);
+    return gather(sample, w);
+  }
+
+  // reads delay samples behind index, where a delay of 0 is the sample at index itself
+  static inline float behind(const T* buf, size_t mask, size_t index, float delay)
+  {
+    const size_t d = (size_t)delay;
+    float w[kTaps];
+    Kernel::weights(delay - d, w);
+    const size_t first = index - d + kBefore;
+    float sum = 0;
+    for (int k = 0; k < kTaps; ++k)
+    {
+      sum += Storage::load(buf[((first - k) & mask) * stride]) * w[k];
+    }
+    return sum;
+  }
+
+  // block reads. the positions are worked out from the start of the block rather than accumulated,
+  // and when none of the taps for the block wrap around the end of the buffer they are read without masking.
+
+  // reads len samples starting at position and moving forwards by step each sample, step must not be negative
+  static void readRamp(const T* buf, size_t mask, float* out, size_t len, float position, float step)
+  {
+    if (!len)
+    {
+      return;
+    }
+    const size_t first = (size_t)position;
+    const size_t last = (size_t)(position + step * (len - 1));
+    if (first >= (size_t)kBefore && last + kAfter <= mask)
+    {
+      const T* base = buf + first * stride;
+      for (size_t i = 0; i < len; ++i)
+      {
+        const float p = position + step * i;
+        const size_t idx = (size_t)p;
+        out[i] = gather(base + (idx - first) * stride, p - idx);
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < len; ++i)
+      {
+        out[i] = read(buf, mask, position + step * i);
+      }
+    }
+  }
+
+  // reads from memory that holds every tap without wrapping, sample points at the sample a whole delay behind
+  static inline float gatherBehind(const T* sample, const float* weights)
+  {
+    const T* first = sample + kBefore * stride;
+    float sum = 0;
+    for (int k = 0; k < kTaps; ++k)
+    {
+      sum += Storage::load(first[-k * stride]) * weights[k];
+    }
+    return sum;
+  }
+
+  // true when reading index, index + 1, ... index + len - 1 at a delay that starts at delay
+  // and moves by delayStep each sample doesn't need any taps from across the end of the buffer.
+  static bool fitsBehind(size_t mask, size_t index, size_t len, float delay, float delayStep)
+  {
+    const float lastDelay = delay + delayStep * (len - 1);
+    const float minDelay = delay < lastDelay ? delay : lastDelay;
+    const float maxDelay = delay < lastDelay ? lastDelay : delay;
+    const ptrdiff_t lowest = (ptrdiff_t)index - (ptrdiff_t)maxDelay - 1 - kAfter;
+    const ptrdiff_t highest = (ptrdiff_t)(index + len - 1) - (ptrdiff_t)minDelay + kBefore;
+    return lowest >= 0 && highest <= (ptrdiff_t)mask;
+  }
+
+  // reads len samples for index, index + 1, ..., each one delay samples behind,
+  // where the delay starts at delay and moves by delayStep each sample.
+  static void readBehindRamp(const T* buf, size_t mask, float* out, size_t len, size_t index, float delay, float delayStep)
+  {
+    if (!len)
+    {
+      return;
+    }
+    if (fitsBehind(mask, index, len, delay, delayStep))
+    {
+      float w[kTaps];
+      for (size_t i = 0; i < len; ++i)
+      {
+        const float dl = delay + delayStep * i;
+        const size_t d = (size_t)dl;
+        Kernel::weights(dl - d, w);
+        out[i] = gatherBehind(buf + (index + i - d) * stride, w);
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < len; ++i)
+      {
+        out[i] = behind(buf, mask, index + i, delay + delayStep * i);
+      }
+    }
+  }
+};
+
+#endif // __INTERPOLATED_READ_H__
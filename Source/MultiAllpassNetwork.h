@@ -0,0 +1,278 @@
+#ifndef __MULTI_ALLPASS_NETWORK_H__
+#define __MULTI_ALLPASS_NETWORK_H__
+
+// Several allpass networks with the same number of stages, but their own delay lengths,
+// processed side by side. Each stage stores all channels interleaved in one power of two buffer
+// with a shared write position, so every channel is handled in the same pass over the stage
+// and the per-channel math is laid out as lanes the compiler can vectorize.
+#include "SignalProcessor.h"
+#include "AudioBuffer.h"
+#include "SimpleArray.h"
+#include "AllpassNetwork.h"
+#include "message.h"
+#include <type_traits>
+
+// StorageType is the sample type the delay lines are kept in, see DelayStorage.h
+template<int channels, typename StorageType = float>
+class MultiAllpassNetwork : public MultiSignalProcessor
+{
+  using Storage = DelayStorage<StorageType>;
+
+  struct Stage
+  {
+    StorageType* buf;
+    size_t bufPos;
+    size_t bufMask;
+    size_t bufLen[channels];
+  };
+
+  StorageType* buffer;
+  SimpleArray<Stage> stages;
+  float coeff;
+  float amount;
+  float wetPeak;
+  bool ownsBuffer;
+
+  MultiAllpassNetwork(StorageType* bufferData, Stage* stageData, size_t stageCount, float diffusion)
+    : buffer(bufferData), stages(stageData, stageCount), coeff(diffusion), amount(0), wetPeak(0), ownsBuffer(false)
+  {
+
+  }
+
+public:
+  void setAmount(float amt)
+  {
+    amount = amt;
+  }
+
+  void setDiffusion(float diffusion)
+  {
+    coeff = diffusion;
+  }
+
+  // largest absolute value of the wet signal from the last process call
+  float getWetPeak() const
+  {
+    return wetPeak;
+  }
+
+  // frames of delay memory used by each channel
+  size_t getMemoryLength() const
+  {
+    size_t len = 0;
+    for (size_t s = 0; s < stages.getSize(); ++s)
+    {
+      len += stages[s].bufMask + 1;
+    }
+    return len;
+  }
+
+  void process(const float* const* input, float* const* output, size_t size)
+  {
+    const size_t stageCount = stages.getSize();
+    float peak[channels] = {};
+    size_t n = 0;
+    while (n < size)
+    {
+      const size_t len = size - n < kBlockChunk ? size - n : kBlockChunk;
+      // the chunk interleaved like the delay lines, so each stage reads and writes it in frames
+      float x[kBlockChunk * channels];
+      for (int c = 0; c < channels; ++c)
+      {
+        const float* in = input[c] + n;
+        for (size_t i = 0; i < len; ++i)
+        {
+          x[i * channels + c] = in[i];
+        }
+      }
+      for (size_t s = 0; s < stageCount; ++s)
+      {
+        processStage(stages[s], x, len);
+      }
+      for (int c = 0; c < channels; ++c)
+      {
+        const float* in = input[c] + n;
+        float* out = output[c] + n;
+        for (size_t i = 0; i < len; ++i)
+        {
+          const float wet = x[i * channels + c];
+          out[i] = in[i] + amount * (wet - in[i]);
+          const float mag = wet < 0 ? -wet : wet;
+          peak[c] = mag > peak[c] ? mag : peak[c];
+        }
+      }
+      n += len;
+    }
+    wetPeak = 0;
+    for (int c = 0; c < channels; ++c)
+    {
+      wetPeak = peak[c] > wetPeak ? peak[c] : wetPeak;
+    }
+  }
+
+  // one channel of the buffers per lane, so with more lanes than an OWL buffer's two use the pointer version
+  void process(AudioBuffer& input, AudioBuffer& output) override
+  {
+    ASSERT(input.getChannels() >= channels && output.getChannels() >= channels, "MultiAllpassNetwork has more lanes than the buffer has channels!");
+    const float* in[channels];
+    float* out[channels];
+    for (int c = 0; c < channels; ++c)
+    {
+      in[c] = input.getSamples(c);
+      out[c] = output.getSamples(c);
+    }
+    process(in, out, input.getSize());
+  }
+
+  // delayLengths holds stageCount lengths for each channel
+  static size_t getBufferSize(const size_t* const delayLengths[channels], size_t stageCount)
+  {
+    size_t bufferSize = 0;
+    for (size_t s = 0; s < stageCount; ++s)
+    {
+      bufferSize += getStageLength(delayLengths, s) * channels;
+    }
+    return bufferSize;
+  }
+
+  static MultiAllpassNetwork* create(const size_t* const delayLengths[channels], size_t stageCount, float diffusion)
+  {
+    size_t bufferSize = getBufferSize(delayLengths, stageCount);
+    StorageType* bufferData = new StorageType[bufferSize];
+    memset(bufferData, 0, sizeof(StorageType)*bufferSize);
+    MultiAllpassNetwork* network = create(delayLengths, stageCount, diffusion, bufferData);
+    network->ownsBuffer = true;
+    return network;
+  }
+
+  // create a network whose delay lines live in memory owned by the caller,
+  // which must be at least getBufferSize samples long and cleared.
+  static MultiAllpassNetwork* create(const size_t* const delayLengths[channels], size_t stageCount, float diffusion, StorageType* bufferData)
+  {
+    Stage* stageData = new Stage[stageCount];
+    StorageType* head = bufferData;
+    for (size_t s = 0; s < stageCount; ++s)
+    {
+      size_t len = getStageLength(delayLengths, s);
+      Stage& st = stageData[s];
+      st.buf = head;
+      st.bufPos = 0;
+      st.bufMask = len - 1;
+      for (int c = 0; c < channels; ++c)
+      {
+        st.bufLen[c] = delayLengths[c][s];
+      }
+      head += len * channels;
+    }
+    return new MultiAllpassNetwork(bufferData, stageData, stageCount, diffusion);
+  }
+
+  static void destroy(MultiAllpassNetwork* network)
+  {
+    if (network->ownsBuffer)
+    {
+      delete[] network->buffer;
+    }
+    delete[] network->stages.getData();
+    delete network;
+  }
+
+private:
+  // frames run through every stage before moving on to the next chunk
+  static constexpr size_t kBlockChunk = 64;
+
+  // inOut holds len interleaved frames
+  void processStage(Stage& st, float* inOut, size_t len)
+  {
+    const size_t bufSize = st.bufMask + 1;
+    size_t w = st.bufPos;
+    while (len)
+    {
+      // largest span where neither the write position nor any channel's read position wraps
+      size_t span = bufSize - w;
+      size_t r[channels];
+      for (int c = 0; c < channels; ++c)
+      {
+        r[c] = (w - st.bufLen[c]) & st.bufMask;
+        if (bufSize - r[c] < span)
+        {
+          span = bufSize - r[c];
+        }
+      }
+      if (span > len)
+      {
+        span = len;
+      }
+      StorageType* wp = st.buf + w * channels;
+      if constexpr (std::is_same<StorageType, float>::value)
+      {
+        for (size_t i = 0; i < span; ++i)
+        {
+          for (int c = 0; c < channels; ++c)
+          {
+            float y = st.buf[(r[c] + i) * channels + c];
+            float z = coeff * y + inOut[i * channels + c];
+            wp[i * channels + c] = z;
+            inOut[i * channels + c] = y - coeff * z;
+          }
+        }
+      }
+      else
+      {
+        // convert the span each channel reads to float and the frames we write back in bulk,
+        // which means the span can't be long enough for any channel to read what it writes.
+        for (int c = 0; c < channels; ++c)
+        {
+          if (span > st.bufLen[c])
+          {
+            span = st.bufLen[c];
+          }
+        }
+        float y[kBlockChunk * channels];
+        for (int c = 0; c < channels; ++c)
+        {
+          const StorageType* rp = st.buf + r[c] * channels + c;
+          for (size_t i = 0; i < span; ++i)
+          {
+            y[i * channels + c] = Storage::load(rp[i * channels]);
+          }
+        }
+        const size_t count = span * channels;
+        for (size_t i = 0; i < count; ++i)
+        {
+          float z = coeff * y[i] + inOut[i];
+          inOut[i] = y[i] - coeff * z;
+          y[i] = z;
+        }
+        Storage::storeBlock(y, wp, count);
+      }
+      inOut += span * channels;
+      len -= span;
+      w = (w + span) & st.bufMask;
+    }
+    st.bufPos = w;
+  }
+
+  // frames needed by a stage, which is padded to fit its longest channel
+  static size_t getStageLength(const size_t* const delayLengths[channels], int stage)
+  {
+    size_t longest = 0;
+    for (int c = 0; c < channels; ++c)
+    {
+      if (delayLengths[c][stage] > longest)
+      {
+        longest = delayLengths[c][stage];
+      }
+    }
+    return AllpassNetwork::getPaddedLength(longest);
+  }
+};
+
+typedef MultiAllpassNetwork<2> StereoAllpassNetwork;
+typedef MultiAllpassNetwork<4> QuadAllpassNetwork;
+typedef MultiAllpassNetwork<2, int16_t> ShortStereoAllpassNetwork;
+#ifdef DELAY_STORAGE_HALF
+typedef MultiAllpassNetwork<2, Half> HalfStereoAllpassNetwork;
+#endif
+
+#endif // __MULTI_ALLPASS_NETWORK_H__
@@ -0,0 +1,248 @@
+#pragma once
+#ifndef __MULTI_TAP_DELAY_H__
+#define __MULTI_TAP_DELAY_H__
+
+#include <string.h>
+#include "FloatArray.h"
+#include "InterpolatedRead.h"
+
+// Reads any number of taps from one circular buffer in a single pass over the block.
+// Reading each tap with its own pass streams the block through memory once per tap;
+// here every output sample of every tap is produced in the same loop,
+// so taps that sit closer together than a block share the cache lines they read,
+// and the per-sample work of stepping through the block is only done once.
+// Each tap has a delay, a gain and a one pole low pass, which ramp from the last block's values to the new ones.
+// The buffer size must be a power of two, mask is the size minus one.
+template<int tapCount, InterpolationQuality quality = InterpolationQuality::Linear, typename StorageType = float>
+class MultiTapReader
+{
+  using Read = InterpolatedRead<quality, StorageType>;
+
+  struct Tap
+  {
+    float delay;
+    float gain;
+    // one pole coefficient in (0, 1], where 1 lets everything through
+    float lowPass;
+  };
+
+  Tap target[tapCount];
+  Tap current[tapCount];
+  float filterState[tapCount];
+
+public:
+  MultiTapReader()
+  {
+    Read::prepare();
+    for (int k = 0; k < tapCount; ++k)
+    {
+      target[k] = current[k] = { 0, 1, 1 };
+      filterState[k] = 0;
+    }
+  }
+
+  static constexpr int getTapCount() { return tapCount; }
+
+  // delay in samples behind the sample being read for, 0 is the sample written at that index
+  void setDelay(int tap, float delay)
+  {
+    target[tap].delay = delay;
+  }
+
+  float getDelay(int tap) const
+  {
+    return target[tap].delay;
+  }
+
+  void setGain(int tap, float gain)
+  {
+    target[tap].gain = gain;
+  }
+
+  void setLowPass(int tap, float coefficient)
+  {
+    target[tap].lowPass = coefficient;
+  }
+
+  void clear()
+  {
+    for (int k = 0; k < tapCount; ++k)
+    {
+      filterState[k] = 0;
+    }
+  }
+
+  // writes every tap into its own output, for the block of len samples that were written starting at index.
+  void process(const StorageType* buf, size_t mask, size_t index, float* const* outputs, size_t len)
+  {
+    run<false>(buf, mask, index, outputs, len);
+  }
+
+  // writes the sum of all of the taps into output
+  void processMix(const StorageType* buf, size_t mask, size_t index, float* output, size_t len)
+  {
+    run<true>(buf, mask, index, &output, len);
+  }
+
+private:
+  template<bool mix>
+  void run(const StorageType* buf, size_t mask, size_t index, float* const* outputs, size_t len)
+  {
+    if (!len)
+    {
+      return;
+    }
+
+    Tap step[tapCount];
+    bool fits = true;
+    for (int k = 0; k < tapCount; ++k)
+    {
+      step[k].delay = (target[k].delay - current[k].delay) / len;
+      step[k].gain = (target[k].gain - current[k].gain) / len;
+      step[k].lowPass = (target[k].lowPass - current[k].lowPass) / len;
+      fits = fits && Read::fitsBehind(mask, index, len, current[k].delay + step[k].delay, step[k].delay);
+    }
+
+    if (fits)
+    {
+      tapLoop<mix, true>(buf, mask, index, outputs, len, step);
+    }
+    else
+    {
+      tapLoop<mix, false>(buf, mask, index, outputs, len, step);
+    }
+
+    for (int k = 0; k < tapCount; ++k)
+    {
+      current[k] = target[k];
+    }
+  }
+
+  // parameters are ramped so that the last sample of the block is at the target
+  template<bool mix, bool fits>
+  void tapLoop(const StorageType* buf, size_t mask, size_t index, float* const* outputs, size_t len, const Tap* step)
+  {
+    float state[tapCount];
+    for (int k = 0; k < tapCount; ++k)
+    {
+      state[k] = filterState[k];
+    }
+
+    float w[Read::kTaps];
+    for (size_t i = 0; i < len; ++i)
+    {
+      const float n = (float)(i + 1);
+      float sum = 0;
+      for (int k = 0; k < tapCount; ++k)
+      {
+        const float delay = current[k].delay + step[k].delay * n;
+        float x;
+        if constexpr(fits)
+        {
+          const size_t d = (size_t)delay;
+          Read::Kernel::weights(delay - d, w);
+          x = Read::gatherBehind(buf + index + i - d, w);
+        }
+        else
+        {
+          x = Read::behind(buf, mask, index + i, delay);
+        }
+        state[k] += (current[k].lowPass + step[k].lowPass * n) * (x - state[k]);
+        const float y = state[k] * (current[k].gain + step[k].gain * n);
+        if constexpr(mix)
+        {
+          sum += y;
+        }
+        else
+        {
+          outputs[k][i] = y;
+        }
+      }
+      if constexpr(mix)
+      {
+        outputs[0][i] = sum;
+      }
+    }
+
+    for (int k = 0; k < tapCount; ++k)
+    {
+      filterState[k] = state[k];
+    }
+  }
+};
+
+// A mono delay line with tapCount taps read by a MultiTapReader.
+template<int tapCount, InterpolationQuality quality = InterpolationQuality::Linear>
+class MultiTapDelay
+{
+  float* buffer;
+  size_t mask;
+  size_t writeIndex;
+  MultiTapReader<tapCount, quality> reader;
+
+  MultiTapDelay(float* buffer, size_t size)
+    : buffer(buffer), mask(size - 1), writeIndex(0)
+  {
+  }
+
+  // returns the index the block starts at
+  size_t write(const float* input, size_t len)
+  {
+    const size_t start = writeIndex;
+    while (len)
+    {
+      const size_t span = len < mask + 1 - writeIndex ? len : mask + 1 - writeIndex;
+      memcpy(buffer + writeIndex, input, span * sizeof(float));
+      input += span;
+      len -= span;
+      writeIndex = (writeIndex + span) & mask;
+    }
+    return start;
+  }
+
+public:
+  MultiTapReader<tapCount, quality>& taps()
+  {
+    return reader;
+  }
+
+  void clear()
+  {
+    memset(buffer, 0, (mask + 1) * sizeof(float));
+    reader.clear();
+  }
+
+  // the whole input block is written before the taps read, so input and outputs may be the same arrays
+  void process(FloatArray input, float* const* outputs)
+  {
+    const size_t len = input.getSize();
+    reader.process(buffer, mask, write(input.getData(), len), outputs, len);
+  }
+
+  void processMix(FloatArray input, FloatArray output)
+  {
+    const size_t len = input.getSize();
+    reader.processMix(buffer, mask, write(input.getData(), len), output.getData(), len);
+  }
+
+  // tap delays should be no longer than maxDelayLength
+  static MultiTapDelay* create(size_t maxDelayLength, size_t blockSize)
+  {
+    size_t size = 1;
+    while (size < maxDelayLength + blockSize + InterpolatedRead<quality>::kTaps)
+    {
+      size <<= 1;
+    }
+    MultiTapDelay* delay = new MultiTapDelay(new float[size], size);
+    delay->clear();
+    return delay;
+  }
+
+  static void destroy(MultiTapDelay* delay)
+  {
+    delete[] delay->buffer;
+    delete delay;
+  }
+};
+
+#endif // __MULTI_TAP_DELAY_H__
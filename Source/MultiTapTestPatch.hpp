@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Patch.h"
+#include "MultiTapDelay.h"
+
+// Compares reading the taps of one delay line with a pass over the block for each tap
+// against MultiTapDelay, which reads every tap in the same pass.
+// Both run every block on the left input with the same delays, gains and filters.
+// Parameter A spreads the taps from a few blocks apart to across the whole delay,
+// B picks which one is heard, and F and G show the CPU of each.
+class MultiTapTestPatch : public Patch
+{
+  static const int TAP_COUNT = 8;
+  // about 1.4 seconds at 48k
+  static const int MAX_DELAY = 1 << 16;
+  static constexpr float TAP_GAIN = 1.0f / TAP_COUNT;
+  static constexpr float TAP_LOW_PASS = 0.5f;
+
+  typedef MultiTapDelay<TAP_COUNT> Delay;
+  using Read = InterpolatedRead<InterpolationQuality::Linear>;
+
+  Delay* multiTap;
+
+  // the same delay line, read a tap at a time
+  float* buffer;
+  size_t mask;
+  size_t writeIndex;
+  float tapDelay[TAP_COUNT];
+  float lastDelay[TAP_COUNT];
+  float tapState[TAP_COUNT];
+  FloatArray tapBlock;
+  FloatArray perTapOut;
+
+public:
+  MultiTapTestPatch() : Patch(), writeIndex(0)
+  {
+    multiTap = Delay::create(MAX_DELAY, getBlockSize());
+    size_t size = 1;
+    while (size < (size_t)(MAX_DELAY + getBlockSize() + Read::kTaps))
+    {
+      size <<= 1;
+    }
+    buffer = new float[size];
+    memset(buffer, 0, size * sizeof(float));
+    mask = size - 1;
+    tapBlock = FloatArray::create(getBlockSize());
+    perTapOut = FloatArray::create(getBlockSize());
+    for (int k = 0; k < TAP_COUNT; ++k)
+    {
+      tapDelay[k] = lastDelay[k] = 0;
+      tapState[k] = 0;
+      multiTap->taps().setGain(k, TAP_GAIN);
+      multiTap->taps().setLowPass(k, TAP_LOW_PASS);
+    }
+
+    registerParameter(PARAMETER_A, "Tap Spread");
+    registerParameter(PARAMETER_B, "Multi Tap");
+    registerParameter(PARAMETER_F, "Per Tap CPU>>");
+    registerParameter(PARAMETER_G, "Multi Tap CPU>>");
+  }
+
+  ~MultiTapTestPatch()
+  {
+    Delay::destroy(multiTap);
+    delete[] buffer;
+    FloatArray::destroy(tapBlock);
+    FloatArray::destroy(perTapOut);
+  }
+
+  // returns CPU% as [0,1] value
+  float getElapsedTime()
+  {
+    return getElapsedCycles() / getBlockSize() / 10000.0f;
+  }
+
+  void processAudio(AudioBuffer& audio) override
+  {
+    const int size = audio.getSize();
+    FloatArray left = audio.getSamples(LEFT_CHANNEL);
+    FloatArray right = audio.getSamples(RIGHT_CHANNEL);
+
+    const float spread = 0.02f + getParameterValue(PARAMETER_A) * 0.98f;
+    for (int k = 0; k < TAP_COUNT; ++k)
+    {
+      tapDelay[k] = (k + 1) * spread * (MAX_DELAY - 1) / TAP_COUNT;
+      multiTap->taps().setDelay(k, tapDelay[k]);
+    }
+
+    float time = getElapsedTime();
+    readPerTap(left, perTapOut, size);
+    const float perTapTime = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    multiTap->processMix(left, right);
+    const float multiTapTime = getElapsedTime() - time;
+
+    if (getParameterValue(PARAMETER_B) < 0.5f)
+    {
+      perTapOut.copyTo(right);
+    }
+    right.copyTo(left);
+
+    setParameterValue(PARAMETER_F, perTapTime);
+    setParameterValue(PARAMETER_G, multiTapTime);
+  }
+
+private:
+  // what the taps cost without MultiTapReader, each one streams the block through memory on its own
+  void readPerTap(const float* input, float* output, int size)
+  {
+    const size_t start = writeIndex;
+    for (int i = 0; i < size; ++i)
+    {
+      buffer[writeIndex] = input[i];
+      writeIndex = (writeIndex + 1) & mask;
+    }
+    memset(output, 0, size * sizeof(float));
+    for (int k = 0; k < TAP_COUNT; ++k)
+    {
+      // ramped so that the last sample of the block is at the new delay, like MultiTapReader
+      const float step = (tapDelay[k] - lastDelay[k]) / size;
+      Read::readBehindRamp(buffer, mask, tapBlock, size, start, lastDelay[k] + step, step);
+      lastDelay[k] = tapDelay[k];
+      float state = tapState[k];
+      for (int i = 0; i < size; ++i)
+      {
+        state += TAP_LOW_PASS * (tapBlock[i] - state);
+        output[i] += state * TAP_GAIN;
+      }
+      tapState[k] = state;
+    }
+  }
+};
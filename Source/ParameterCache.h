@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Patch.h"
+
+// Mirrors of parameter values that remember what they were last block,
+// so that derived state like filter coefficients or tap lengths is only recalculated when a parameter moves.
+// update polls the value once per block and returns whether it changed, changed keeps that answer until the next update.
+
+// Stands in for a PatchParameterId, which it converts to, so it can be registered and set like one.
+class ParameterMirror
+{
+  PatchParameterId pid;
+  float value;
+  bool dirty;
+  // the first update always reports a change
+  bool fresh;
+
+public:
+  ParameterMirror(PatchParameterId id = PARAMETER_A) : pid(id), value(0), dirty(true), fresh(true)
+  {
+  }
+
+  operator PatchParameterId() const { return pid; }
+
+  // reads the value the parameter was registered with, so getValue is right before the first block.
+  // the first update still reports a change.
+  void seed(Patch* patch)
+  {
+    value = patch->getParameterValue(pid);
+    dirty = fresh = true;
+  }
+
+  bool update(Patch* patch)
+  {
+    const float v = patch->getParameterValue(pid);
+    dirty = fresh || v != value;
+    fresh = false;
+    value = v;
+    return dirty;
+  }
+
+  // polls the parameter and assigns it to target only when it has changed
+  template<typename Target>
+  bool update(Patch* patch, Target&& target)
+  {
+    if (update(patch))
+    {
+      target = value;
+    }
+    return dirty;
+  }
+
+  bool changed() const { return dirty; }
+  float getValue() const { return value; }
+};
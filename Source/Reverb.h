@@ -5,21 +5,81 @@
 #include "SignalProcessor.h"
 #include "SineOscillator.h"
 #include "AudioBuffer.h"
+#include "FloatArray.h"
 #include "AllpassNetwork.h"
-#include "CircularBuffer.h"
-#include "InterpolatingCircularBuffer.h"
+#include "DelayStorage.h"
+#include "InterpolatedRead.h"
+#include "SilenceDetector.h"
 
-class Reverb : public MultiSignalProcessor
+// Eco runs two input diffusion stages and one per tank allpass, no smearing and LFOs updated every 32 samples.
+// Standard is the full topology with LFOs updated every 8 samples.
+// Lush updates the LFOs every sample and reads the modulated tank delay with cubic interpolation.
+enum class ReverbQuality : uint8_t
+{
+  Eco,
+  Standard,
+  Lush
+};
+
+// StorageType is the sample type the delay lines are kept in, see DelayStorage.h
+template<typename StorageType>
+class ReverbTemplate : public MultiSignalProcessor
 {
   using LFO = SineOscillator;
+  using Storage = DelayStorage<StorageType>;
+  using Allpass = AllpassNetworkTemplate<StorageType>;
 
-  AllpassNetwork* diffuser;
-  AllpassNetwork* dap1;
-  AllpassNetwork* dap2;
+  // the LFOs are only generated once every control period and are ramped linearly in between.
+  // the smear taps on the input diffuser are also processed a control period at a time,
+  // so at lower sample rates the period is shortened to stay under the shortest smear read
+  // and the gap between the smear write and where the diffuser reads it back.
+  static constexpr int kMaxControlPeriod = 8;
+  static constexpr int kEcoControlPeriod = 32;
+
+  // all of the delay times are tuned for this sample rate and scaled to the one we run at
+  static constexpr float kReferenceSampleRate = 48000.0f;
+
+  // power of two sized delay line, writePos is where the next sample will be written.
+  struct DelayLine
+  {
+    StorageType* buf;
+    size_t writePos;
+    size_t mask;
+  };
+
+  Allpass* diffuser;
+  Allpass* dap1;
+  Allpass* dap2;
   LFO* lfo1;
   LFO* lfo2;
-  CircularFloatBuffer* delay1;
-  CircularFloatBuffer* delay2;
+  DelayLine delay1;
+  DelayLine delay2;
+  // every allpass and delay line and the scratch memory are carved out of this
+  char* pool;
+  size_t poolSize;
+  // holds the diffused input and the accumulator for one channel
+  float* scratch;
+  int blockSize;
+  int controlPeriod;
+  // longest control period the smear taps allow at our sample rate
+  int smearPeriodLimit;
+  ReverbQuality quality;
+  bool smearEnabled;
+  bool cubicTap;
+  SilenceDetector silence;
+  // whether the last process call was skipped because input and tail were silent
+  bool bypassed;
+
+  // delay lengths and modulation depths in samples at our sample rate
+  size_t delay1Length;
+  float delay2Base;
+  float delay2Depth;
+  float smearBase;
+  float smearDepth;
+  int smearWrite;
+
+  float lfoValue1;
+  float lfoValue2;
   float lpDecay1;
   float lpDecay2;
 
@@ -28,46 +88,164 @@ class Reverb : public MultiSignalProcessor
   float lpAmount;
   float wetAmount;
 
-  Reverb(AllpassNetwork* diffuser, AllpassNetwork* dap1, AllpassNetwork* dap2,
-         LFO* lfo1, LFO* lfo2, CircularFloatBuffer* delay1, CircularFloatBuffer* delay2)
-    : diffuser(diffuser), dap1(dap1), dap2(dap2), lfo1(lfo1), lfo2(lfo2), delay1(delay1), delay2(delay2)
-    , lpDecay1(0), lpDecay2(0), inputGain(0.2f), reverbTime(0), lpAmount(0.7f), wetAmount(0)
+  ReverbTemplate(Allpass* diffuser, Allpass* dap1, Allpass* dap2, LFO* lfo1, LFO* lfo2,
+                 char* pool, int blockSize, float scale)
+    : diffuser(diffuser), dap1(dap1), dap2(dap2), lfo1(lfo1), lfo2(lfo2)
+    , pool(pool), blockSize(blockSize)
+    , bypassed(false), lpDecay1(0), lpDecay2(0), inputGain(0.2f), reverbTime(0), lpAmount(0.7f), wetAmount(0)
   {
-    lfo1->setFrequency(0.5f);
-    lfo2->setFrequency(0.3f);
-    delay1->setDelay(delay1->getSize() - 1);
-    delay2->setDelay(delay2->getSize() - 1);
+    delay1Length = scaled(3410, scale);
+    delay2Base = 4680.0f * scale;
+    delay2Depth = 100.0f * scale;
+    smearBase = 10.0f * scale;
+    smearDepth = 60.0f * scale;
+    smearWrite = scaled(100, scale);
+
+    smearPeriodLimit = min((int)smearBase, (int)diffuser->getDelayLength(0) - smearWrite);
+    controlPeriod = 0;
+    quality = ReverbQuality::Eco;
+    setQuality(ReverbQuality::Standard);
+    lfoValue1 = lfo1->generate()*0.5f + 0.5f;
+    lfoValue2 = lfo2->generate()*0.5f + 0.5f;
     setDiffusion(0.625f);
   }
 
+  void setControlPeriod(int period)
+  {
+    if (period != controlPeriod)
+    {
+      controlPeriod = period;
+      // generating once per control period means the LFOs have to run that many times faster
+      lfo1->setFrequency(0.5f * controlPeriod);
+      lfo2->setFrequency(0.3f * controlPeriod);
+    }
+  }
+
 public:
 
-  static Reverb* create(float sr)
+  static ReverbTemplate* create(float sr, int blockSize)
   {
-    static size_t diffuseTimes[4] { 113, 162, 241, 399 };
-    static size_t dap1Times[2]{ 1653, 2038 };
-    static size_t dap2Times[2]{ 1913, 1663 };
+    static const size_t diffuseTimes[4] { 113, 162, 241, 399 };
+    static const size_t dap1Times[2]{ 1653, 2038 };
+    static const size_t dap2Times[2]{ 1913, 1663 };
+
+    const float scale = sr / kReferenceSampleRate;
+    size_t diffuseLen[4];
+    size_t dap1Len[2];
+    size_t dap2Len[2];
+    for (int i = 0; i < 4; ++i)
+    {
+      diffuseLen[i] = scaled(diffuseTimes[i], scale);
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+      dap1Len[i] = scaled(dap1Times[i], scale);
+      dap2Len[i] = scaled(dap2Times[i], scale);
+    }
+
+    // the delays are written a block at a time, so they need room for a block on top of their longest read
+    const size_t delay1Size = Allpass::getPaddedLength(scaled(3410, scale) + blockSize);
+    const size_t delay2Size = Allpass::getPaddedLength(scaled(4782, scale) + blockSize);
+    ASSERT(blockSize <= (int)scaled(3410, scale), "Reverb block size is longer than its shortest delay!");
+
+    const size_t diffuseSize = Allpass::getBufferSize(diffuseLen, 4);
+    const size_t dap1Size = Allpass::getBufferSize(dap1Len, 2);
+    const size_t dap2Size = Allpass::getBufferSize(dap2Len, 2);
+    // every line is a power of two long, so the float scratch at the end stays aligned
+    const size_t lineSize = diffuseSize + dap1Size + delay1Size + dap2Size + delay2Size;
+    const size_t poolSize = lineSize * sizeof(StorageType) + blockSize * 2 * sizeof(float);
+    char* pool = new char[poolSize];
+    memset(pool, 0, poolSize);
 
-    return new Reverb(AllpassNetwork::create(diffuseTimes, 4, 0.625f),
-      AllpassNetwork::create(dap1Times, 2, 0.625f),
-      AllpassNetwork::create(dap2Times, 2, 0.625f),
-      LFO::create(sr), LFO::create(sr),
-      CircularFloatBuffer::create(3411),
-      CircularFloatBuffer::create(4782));
+    // laid out in the order they are processed
+    StorageType* head = reinterpret_cast<StorageType*>(pool);
+    Allpass* diffuser = Allpass::create(diffuseLen, 4, 0.625f, head);
+    head += diffuseSize;
+    Allpass* dap1 = Allpass::create(dap1Len, 2, 0.625f, head);
+    head += dap1Size;
+    StorageType* delay1Data = head;
+    head += delay1Size;
+    Allpass* dap2 = Allpass::create(dap2Len, 2, 0.625f, head);
+    head += dap2Size;
+    StorageType* delay2Data = head;
+    head += delay2Size;
+
+    ReverbTemplate* reverb = new ReverbTemplate(diffuser, dap1, dap2, LFO::create(sr), LFO::create(sr), pool, blockSize, scale);
+    reverb->delay1 = { delay1Data, 0, delay1Size - 1 };
+    reverb->delay2 = { delay2Data, 0, delay2Size - 1 };
+    reverb->scratch = reinterpret_cast<float*>(head);
+    reverb->poolSize = poolSize;
+    // a tail can't outlast everything it is able to recirculate through
+    reverb->silence.setMemoryLength(lineSize);
+    return reverb;
+  }
+
+  // bytes of delay and scratch memory used
+  size_t getMemorySize() const
+  {
+    return poolSize;
   }
 
-  static void destroy(Reverb* reverb)
+  static void destroy(ReverbTemplate* reverb)
   {
-    AllpassNetwork::destroy(reverb->diffuser);
-    AllpassNetwork::destroy(reverb->dap1);
-    AllpassNetwork::destroy(reverb->dap2);
+    Allpass::destroy(reverb->diffuser);
+    Allpass::destroy(reverb->dap1);
+    Allpass::destroy(reverb->dap2);
     LFO::destroy(reverb->lfo1);
     LFO::destroy(reverb->lfo2);
-    CircularFloatBuffer::destroy(reverb->delay1);
-    CircularFloatBuffer::destroy(reverb->delay2);
+    delete[] reverb->pool;
     delete reverb;
   }
 
+  // can be changed while running: LFO ramps carry on from where they are
+  // and the allpasses crossfade when their stage count changes.
+  void setQuality(ReverbQuality q)
+  {
+    if (q == quality)
+    {
+      return;
+    }
+    quality = q;
+    switch (quality)
+    {
+    case ReverbQuality::Eco:
+      diffuser->setActiveStages(2);
+      dap1->setActiveStages(1);
+      dap2->setActiveStages(1);
+      smearEnabled = false;
+      cubicTap = false;
+      setControlPeriod(kEcoControlPeriod);
+      break;
+    case ReverbQuality::Standard:
+      diffuser->setActiveStages(4);
+      dap1->setActiveStages(2);
+      dap2->setActiveStages(2);
+      smearEnabled = true;
+      cubicTap = false;
+      setControlPeriod(min(kMaxControlPeriod, smearPeriodLimit));
+      break;
+    case ReverbQuality::Lush:
+      diffuser->setActiveStages(4);
+      dap1->setActiveStages(2);
+      dap2->setActiveStages(2);
+      smearEnabled = true;
+      cubicTap = true;
+      setControlPeriod(1);
+      break;
+    }
+  }
+
+  ReverbQuality getQuality() const
+  {
+    return quality;
+  }
+
+  // a bypassed block costs next to nothing, so it says nothing about what the reverb costs
+  bool isBypassed() const
+  {
+    return bypassed;
+  }
+
   void setInputGain(float amt)
   {
     inputGain = amt;
@@ -97,62 +275,187 @@ public:
 
   void process(AudioBuffer& input, AudioBuffer& output) override
   {
-    float* inL = input.getSamples(0);
-    float* inR = input.getSamples(1);
+    const float* inL = input.getSamples(0);
+    const float* inR = input.getSamples(1);
     float* outL = output.getSamples(0);
     float* outR = output.getSamples(1);
     int size = input.getSize();
-    float lp1 = lpDecay1;
-    float lp2 = lpDecay2;
-    while (size--)
+
+    const float leftPeak = SilenceDetector::peak(input.getSamples(0));
+    const float rightPeak = SilenceDetector::peak(input.getSamples(1));
+    const float inputPeak = leftPeak > rightPeak ? leftPeak : rightPeak;
+    bypassed = silence.isSilent(inputPeak);
+    if (bypassed)
+    {
+      // the tail has died away and the input is below -120 dB, so all that is left is the dry signal
+      const float dryAmount = 1.0f - wetAmount;
+      for (int i = 0; i < size; ++i)
+      {
+        outL[i] = inL[i] * dryAmount;
+        outR[i] = inR[i] * dryAmount;
+      }
+      return;
+    }
+
+    float peak = inputPeak;
+    while (size)
     {
-      float left = *inL++;
-      float right = *inR++;
-      float m = (left + right) * inputGain;
+      const int len = size < blockSize ? size : blockSize;
+      const float writePeak = processBlock(inL, inR, outL, outR, len);
+      peak = writePeak > peak ? writePeak : peak;
+      inL += len;
+      inR += len;
+      outL += len;
+      outR += len;
+      size -= len;
+    }
+    silence.update(peak, input.getSize());
+  }
 
-      float lfo = lfo1->generate()*0.5f + 0.5f;
-      float smear = diffuser->read(0, 10.0f + lfo * 60.0f);
-      diffuser->write(0, 100, smear);
+private:
+  // input and output may be the same arrays, since each output sample is written after its input has been used.
+  // returns the peak of what was written into the recirculating delays.
+  float processBlock(const float* inL, const float* inR, float* outL, float* outR, const int len)
+  {
+    float* diffused = scratch;
+    float* accum = diffused + blockSize;
+
+    for (int i = 0; i < len; ++i)
+    {
+      diffused[i] = (inL[i] + inR[i]) * inputGain;
+    }
+
+    // smear the first diffuser stage and read the modulated delay2 tap a control period at a time
+    for (int i = 0; i < len; i += controlPeriod)
+    {
+      const int n = len - i < controlPeriod ? len - i : controlPeriod;
+      // each generate moves the LFOs on by a control period, so a shorter last period moves them on by only n samples
+      if (n < controlPeriod)
+      {
+        lfo1->setFrequency(0.5f * n);
+        lfo2->setFrequency(0.3f * n);
+      }
+      const float lfoStep1 = (lfo1->generate()*0.5f + 0.5f - lfoValue1) / n;
+      const float lfoStep2 = (lfo2->generate()*0.5f + 0.5f - lfoValue2) / n;
+      if (n < controlPeriod)
+      {
+        lfo1->setFrequency(0.5f * controlPeriod);
+        lfo2->setFrequency(0.3f * controlPeriod);
+      }
 
-      float d = diffuser->process(m);
+      // the diffuser's read/write positions only advance when it processes,
+      // so offsets are pulled back by how far into the period we are.
+      if (smearEnabled)
+      {
+        for (int k = 0; k < n; ++k)
+        {
+          lfoValue1 += lfoStep1;
+          float smear = diffuser->read(0, smearBase + lfoValue1 * smearDepth - k);
+          diffuser->write(0, smearWrite - k, smear);
+        }
+      }
+      else
+      {
+        lfoValue1 += lfoStep1 * n;
+      }
+      FloatArray period(diffused + i, n);
+      diffuser->process(period, period);
 
-      float accum = d;
-      // interpolated read from delay2
+      // interpolated read from delay2, which has not yet been written this block
+      const size_t w2 = delay2.writePos + i;
+      const float tapDelay = delay2Base + (lfoValue2 + lfoStep2) * delay2Depth;
+      const float tapStep = lfoStep2 * delay2Depth;
+      if (cubicTap)
       {
-        lfo = lfo2->generate()*0.5f + 0.5f;
-        float df = 4680.0f + lfo*100.0f;
-        int da = (int)df;
-        int db = da + 1;
-        float t = df - da;
-        delay2->setDelay(da);
-        float a = delay2->read();
-        delay2->setDelay(db);
-        float b = delay2->read();
-        accum += Interpolator::linear(a, b, t) * reverbTime;
+        InterpolatedRead<InterpolationQuality::Hermite, StorageType>::readBehindRamp(delay2.buf, delay2.mask, accum + i, n, w2, tapDelay, tapStep);
       }
-      // low pass filter
-      lp1 += lpAmount * (accum - lp1);
-      accum = lp1;
-      // through two allpass filters
-      accum = dap1->process(accum);
-      delay1->write(accum);
-      accum *= 2;
+      else
+      {
+        InterpolatedRead<InterpolationQuality::Linear, StorageType>::readBehindRamp(delay2.buf, delay2.mask, accum + i, n, w2, tapDelay, tapStep);
+      }
+      lfoValue2 += lfoStep2 * n;
+      for (int k = i; k < i + n; ++k)
+      {
+        accum[k] = diffused[k] + accum[k] * reverbTime;
+      }
+    }
 
-      *outL++ = left + (accum - left) * wetAmount;
+    // left: low pass filter, through two allpass filters, into delay1
+    float lp = lpDecay1;
+    for (int i = 0; i < len; ++i)
+    {
+      lp += lpAmount * (accum[i] - lp);
+      accum[i] = lp;
+    }
+    lpDecay1 = lp;
+    FloatArray block(accum, len);
+    dap1->process(block, block);
+    writeDelay(delay1, accum, len);
+    const float leftPeak = SilenceDetector::peak(block);
+    for (int i = 0; i < len; ++i)
+    {
+      outL[i] = inL[i] + (accum[i] * 2 - inL[i]) * wetAmount;
+    }
 
-      accum = d;
-      accum += delay1->read() * reverbTime;
-      lp2 += lpAmount * (accum - lp2);
-      accum = lp2;
-      accum = dap2->process(accum);
-      delay2->write(accum);
-      accum *= 2;
+    // right: fixed read from delay1, which is long enough that this block's writes aren't reached
+    readDelay(delay1, accum, delay1Length + len, len);
+    lp = lpDecay2;
+    for (int i = 0; i < len; ++i)
+    {
+      lp += lpAmount * (diffused[i] + accum[i] * reverbTime - lp);
+      accum[i] = lp;
+    }
+    lpDecay2 = lp;
+    dap2->process(block, block);
+    writeDelay(delay2, accum, len);
+    const float rightPeak = SilenceDetector::peak(block);
+    for (int i = 0; i < len; ++i)
+    {
+      outR[i] = inR[i] + (accum[i] * 2 - inR[i]) * wetAmount;
+    }
+    return leftPeak > rightPeak ? leftPeak : rightPeak;
+  }
 
-      *outR++ = right + (accum - right) * wetAmount;
+  // copies len samples into the line in at most two contiguous spans
+  static void writeDelay(DelayLine& d, const float* src, size_t len)
+  {
+    const size_t span = d.mask + 1 - d.writePos;
+    if (len > span)
+    {
+      Storage::storeBlock(src, d.buf + d.writePos, span);
+      Storage::storeBlock(src + span, d.buf, len - span);
     }
+    else
+    {
+      Storage::storeBlock(src, d.buf + d.writePos, len);
+    }
+    d.writePos = (d.writePos + len) & d.mask;
+  }
 
-    lpDecay1 = lp1;
-    lpDecay2 = lp2;
+  // copies len samples starting delay samples behind the write position in at most two contiguous spans
+  static void readDelay(const DelayLine& d, float* dst, size_t delay, size_t len)
+  {
+    const size_t readPos = (d.writePos - delay) & d.mask;
+    const size_t span = d.mask + 1 - readPos;
+    if (len > span)
+    {
+      Storage::loadBlock(d.buf + readPos, dst, span);
+      Storage::loadBlock(d.buf, dst + span, len - span);
+    }
+    else
+    {
+      Storage::loadBlock(d.buf + readPos, dst, len);
+    }
   }
 
+  static size_t scaled(size_t len, float scale)
+  {
+    return (size_t)(len * scale + 0.5f);
+  }
 };
+
+typedef ReverbTemplate<float> Reverb;
+typedef ReverbTemplate<int16_t> ShortReverb;
+#ifdef DELAY_STORAGE_HALF
+typedef ReverbTemplate<Half> HalfReverb;
+#endif
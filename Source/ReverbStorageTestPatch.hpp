@@ -0,0 +1,103 @@
+#pragma once
+
+// declares the half precision storage type, see DelayStorage.h
+#define DELAY_STORAGE_HALF
+#include "Patch.h"
+#include "Diffuser.h"
+#include "Reverb.h"
+
+// Compares the cost of the diffuser and reverb with each delay storage type.
+// All three run every block on the same input, parameter A picks which one is heard.
+class ReverbStorageTestPatch : public Patch
+{
+  Diffuser* floatDiffuser;
+  ShortDiffuser* shortDiffuser;
+  HalfDiffuser* halfDiffuser;
+  Reverb* floatReverb;
+  ShortReverb* shortReverb;
+  HalfReverb* halfReverb;
+  AudioBuffer* shortBuffer;
+  AudioBuffer* halfBuffer;
+
+public:
+  ReverbStorageTestPatch() : Patch()
+  {
+    floatDiffuser = Diffuser::create(getSampleRate());
+    shortDiffuser = ShortDiffuser::create(getSampleRate());
+    halfDiffuser = HalfDiffuser::create(getSampleRate());
+    floatReverb = Reverb::create(getSampleRate(), getBlockSize());
+    shortReverb = ShortReverb::create(getSampleRate(), getBlockSize());
+    halfReverb = HalfReverb::create(getSampleRate(), getBlockSize());
+    shortBuffer = AudioBuffer::create(2, getBlockSize());
+    halfBuffer = AudioBuffer::create(2, getBlockSize());
+
+    registerParameter(PARAMETER_A, "Storage");
+    registerParameter(PARAMETER_F, "Float CPU>>");
+    registerParameter(PARAMETER_G, "Short CPU>>");
+    registerParameter(PARAMETER_H, "Half CPU>>");
+
+    debugMessage("Reverb bytes f/s/h", (int)floatReverb->getMemorySize(), (int)shortReverb->getMemorySize(), (int)halfReverb->getMemorySize());
+  }
+
+  ~ReverbStorageTestPatch()
+  {
+    Diffuser::destroy(floatDiffuser);
+    ShortDiffuser::destroy(shortDiffuser);
+    HalfDiffuser::destroy(halfDiffuser);
+    Reverb::destroy(floatReverb);
+    ShortReverb::destroy(shortReverb);
+    HalfReverb::destroy(halfReverb);
+    AudioBuffer::destroy(shortBuffer);
+    AudioBuffer::destroy(halfBuffer);
+  }
+
+  // returns CPU% as [0,1] value
+  float getElapsedTime()
+  {
+    return getElapsedCycles() / getBlockSize() / 10000.0f;
+  }
+
+  void processAudio(AudioBuffer& audio) override
+  {
+    shortBuffer->copyFrom(audio);
+    halfBuffer->copyFrom(audio);
+
+    float time = getElapsedTime();
+    process(floatDiffuser, floatReverb, audio);
+    float floatTime = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    process(shortDiffuser, shortReverb, *shortBuffer);
+    float shortTime = getElapsedTime() - time;
+
+    time = getElapsedTime();
+    process(halfDiffuser, halfReverb, *halfBuffer);
+    float halfTime = getElapsedTime() - time;
+
+    float storage = getParameterValue(PARAMETER_A);
+    if (storage > 0.66f)
+    {
+      audio.copyFrom(*halfBuffer);
+    }
+    else if (storage > 0.33f)
+    {
+      audio.copyFrom(*shortBuffer);
+    }
+
+    setParameterValue(PARAMETER_F, floatTime);
+    setParameterValue(PARAMETER_G, shortTime);
+    setParameterValue(PARAMETER_H, halfTime);
+  }
+
+private:
+  template<typename DiffuserType, typename ReverbType>
+  static void process(DiffuserType* diffuser, ReverbType* reverb, AudioBuffer& audio)
+  {
+    diffuser->setAmount(0.8f);
+    diffuser->process(audio, audio);
+    reverb->setReverbTime(0.9f);
+    reverb->setLowPass(0.8f);
+    reverb->setAmount(0.5f);
+    reverb->process(audio, audio);
+  }
+};
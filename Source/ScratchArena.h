@@ -0,0 +1,116 @@
+#pragma once
+#ifndef __SCRATCH_ARENA_H__
+#define __SCRATCH_ARENA_H__
+
+#include "FloatArray.h"
+#include "message.h"
+
+// Stack-like scratch memory for temporaries that only live for one block.
+// A patch creates one sized from its block size, resets it at the start of processAudio,
+// and processors borrow from it instead of each keeping their own temp arrays.
+// Memory can be reserved for the life of the arena below what reset gives back,
+// for library objects that want one temp array at construction.
+// The memory can also be handed in, so that the patch decides where it lives.
+class ScratchArena
+{
+  // every allocation is rounded up to this so that any sample type stays aligned
+  static constexpr size_t kAlignment = 8;
+
+  char* memory;
+  size_t capacity;
+  // where reset returns to, everything below it has been reserved
+  size_t base;
+  size_t top;
+  size_t peak;
+  bool ownsMemory;
+
+  ScratchArena(char* memory, size_t capacity)
+    : memory(memory), capacity(capacity), base(0), top(0), peak(0), ownsMemory(false)
+  {
+  }
+
+  char* take(size_t bytes)
+  {
+    bytes = (bytes + kAlignment - 1) & ~(kAlignment - 1);
+    ASSERT(top + bytes <= capacity, "ScratchArena is out of memory!");
+    char* ptr = memory + top;
+    top += bytes;
+    peak = top > peak ? top : peak;
+    return ptr;
+  }
+
+public:
+  // gives back everything borrowed since the last reset
+  void reset()
+  {
+    top = base;
+  }
+
+  template<typename T>
+  T* allocate(size_t count)
+  {
+    return reinterpret_cast<T*>(take(count * sizeof(T)));
+  }
+
+  FloatArray allocateFloats(size_t count)
+  {
+    return FloatArray(allocate<float>(count), count);
+  }
+
+  // memory that stays put until the arena is destroyed, must be done before any borrowing
+  template<typename T>
+  T* reserve(size_t count)
+  {
+    ASSERT(top == base, "ScratchArena can't reserve while memory is borrowed!");
+    T* ptr = allocate<T>(count);
+    base = top;
+    return ptr;
+  }
+
+  // borrows made after getting a mark are given back by releasing it,
+  // for processors that only need their temporaries while they run.
+  size_t getMark() const
+  {
+    return top;
+  }
+
+  void release(size_t mark)
+  {
+    top = mark;
+  }
+
+  // most bytes that have been in use at once, including reserved memory
+  size_t getPeak() const
+  {
+    return peak;
+  }
+
+  size_t getCapacity() const
+  {
+    return capacity;
+  }
+
+  static ScratchArena* create(size_t bytes)
+  {
+    ScratchArena* arena = create(new char[bytes], bytes);
+    arena->ownsMemory = true;
+    return arena;
+  }
+
+  // use memory owned by the caller, which should be aligned to 8 bytes
+  static ScratchArena* create(char* memory, size_t bytes)
+  {
+    return new ScratchArena(memory, bytes);
+  }
+
+  static void destroy(ScratchArena* arena)
+  {
+    if (arena->ownsMemory)
+    {
+      delete[] arena->memory;
+    }
+    delete arena;
+  }
+};
+
+#endif // __SCRATCH_ARENA_H__
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef __SILENCE_DETECTOR_H__
+#define __SILENCE_DETECTOR_H__
+
+#include "FloatArray.h"
+
+// Tracks how long a processor's input and everything it has written into its delay memory
+// have stayed below -120 dB. Once that has lasted longer than the memory is long,
+// the memory holds nothing but silence and the processor can skip its work
+// until the input comes back above the threshold.
+class SilenceDetector
+{
+  static constexpr float kThreshold = 0.000001f;
+
+  size_t silentSamples;
+  size_t memoryLength;
+
+public:
+  // delay memory starts out cleared, so we start out silent
+  SilenceDetector(size_t memoryLength = 0) : silentSamples(memoryLength), memoryLength(memoryLength)
+  {
+  }
+
+  void setMemoryLength(size_t length)
+  {
+    memoryLength = length;
+    silentSamples = length;
+  }
+
+  // true when the block with this input peak can be bypassed
+  bool isSilent(float inputPeak) const
+  {
+    return inputPeak < kThreshold && silentSamples >= memoryLength;
+  }
+
+  // peak should cover the input and what was written into delay memory over len samples
+  void update(float peak, size_t len)
+  {
+    if (peak < kThreshold)
+    {
+      silentSamples = silentSamples + len < memoryLength ? silentSamples + len : memoryLength;
+    }
+    else
+    {
+      silentSamples = 0;
+    }
+  }
+
+  static float peak(FloatArray samples)
+  {
+    const float hi = samples.getMaxValue();
+    const float lo = -samples.getMinValue();
+    return hi > lo ? hi : lo;
+  }
+};
+
+#endif // __SILENCE_DETECTOR_H__
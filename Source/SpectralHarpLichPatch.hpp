@@ -1,6 +1,7 @@
 #include "SpectralHarpPatch.hpp"
 
-typedef SpectralHarpPatch<2048, false, Patch> BasePatch;
+// the reverb starts at the Eco tier, which the Lich can afford, and steps up while there is CPU to spare
+typedef SpectralHarpPatch<2048, true, Patch> BasePatch;
 
 static const SpectralHarpParameterIds spectraHarpLichParams =
 {
@@ -25,9 +26,21 @@ static const SpectralHarpParameterIds spectraHarpLichParams =
 class SpectralHarpLichPatch : public BasePatch
 {
   float highElapsedTime = 0;
+  // CPU averaged over the last few dozen blocks, so a single slow block doesn't change the tier
+  float averageElapsedTime = 0;
+  // reverb tiers above this one have run out of CPU recently
+  ReverbQuality reverbCeiling = ReverbQuality::Lush;
+  // blocks left before the tier can change again, the crossfade and the average have to settle first
+  int reverbSettleBlocks = 0;
+  // blocks the ceiling has had plenty of CPU to spare, it is raised again after ceilingRecoveryBlocks of them
+  int ceilingCalmBlocks = 0;
+  const int ceilingRecoveryBlocks = static_cast<int>(10 * getSampleRate() / getBlockSize());
 
 public:
-  SpectralHarpLichPatch() : BasePatch(spectraHarpLichParams) {}
+  SpectralHarpLichPatch() : BasePatch(spectraHarpLichParams)
+  {
+    reverb->setQuality(ReverbQuality::Eco);
+  }
 
   // returns CPU% as [0,1] value
   float getElapsedTime()
@@ -53,6 +66,56 @@ public:
     //  highElapsedTime += (elapsed - highElapsedTime)*0.001f;
     //}
 
+    updateReverbQuality(elapsed);
+
     debugMessage("CPU High: ", highElapsedTime);
   }
+
+private:
+  // step the reverb up a tier while there is plenty of CPU to spare,
+  // and back down, capping the tier, if the average load gets too close to the limit.
+  // the cap is lifted a tier at a time after about ten seconds of spare CPU,
+  // so a spike at startup doesn't hold the reverb at a lower tier for the rest of the session.
+  // nothing changes while the reverb is bypassed for silence, its blocks are too cheap to say what the tier costs,
+  // and stepping up on them would only leave the tier too high for when the signal comes back.
+  void updateReverbQuality(float elapsed)
+  {
+    if (reverb->isBypassed())
+    {
+      return;
+    }
+    averageElapsedTime += (elapsed - averageElapsedTime) * 0.05f;
+    if (reverbSettleBlocks > 0)
+    {
+      --reverbSettleBlocks;
+      return;
+    }
+
+    const int tier = static_cast<int>(reverb->getQuality());
+    const int ceiling = static_cast<int>(reverbCeiling);
+    if (averageElapsedTime > 0.9f && tier > 0)
+    {
+      reverbCeiling = static_cast<ReverbQuality>(tier - 1);
+      reverb->setQuality(reverbCeiling);
+      reverbSettleBlocks = 64;
+      ceilingCalmBlocks = 0;
+    }
+    else if (averageElapsedTime < 0.6f && tier < ceiling)
+    {
+      reverb->setQuality(static_cast<ReverbQuality>(tier + 1));
+      reverbSettleBlocks = 64;
+    }
+    else if (averageElapsedTime < 0.6f && ceiling < static_cast<int>(ReverbQuality::Lush))
+    {
+      if (++ceilingCalmBlocks >= ceilingRecoveryBlocks)
+      {
+        reverbCeiling = static_cast<ReverbQuality>(ceiling + 1);
+        ceilingCalmBlocks = 0;
+      }
+    }
+    else
+    {
+      ceilingCalmBlocks = 0;
+    }
+  }
 };
@@ -125,6 +125,7 @@ public:
   using PatchClass::getParameterValue;
   using PatchClass::setParameterValue;
   using PatchClass::getSampleRate;
+  using PatchClass::getBlockSize;
   using PatchClass::isButtonPressed;
 
   SpectralHarpPatch(const SpectralHarpParameterIds& paramIds) : PatchClass()
@@ -136,8 +137,8 @@ public:
     
     if (reverb_enabled)
     {
-      diffuser = Diffuser::create();
-      reverb = Reverb::create(getSampleRate());
+      diffuser = Diffuser::create(getSampleRate());
+      reverb = Reverb::create(getSampleRate(), getBlockSize());
     }
 
     midiNotes = new MidiMessage[128];
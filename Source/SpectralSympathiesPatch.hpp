@@ -142,8 +142,8 @@ public:
 
     if (reverb_enabled)
     {
-      diffuser = Diffuser::create();
-      reverb = Reverb::create(getSampleRate());
+      diffuser = Diffuser::create(getSampleRate());
+      reverb = Reverb::create(getSampleRate(), getBlockSize());
     }
 
     midiNotes = new MidiMessage[128];
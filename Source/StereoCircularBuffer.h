@@ -0,0 +1,154 @@
+#pragma once
+#ifndef __STEREO_CIRCULAR_BUFFER_H__
+#define __STEREO_CIRCULAR_BUFFER_H__
+
+#include <string.h>
+
+// Circular buffer of interleaved left/right frames with one write index for both channels.
+// A stereo read works out its position and interpolation once per frame when both channels
+// are at the same delay, and the two samples it needs sit next to each other in memory.
+// The size is a power of two so that indices wrap with a mask.
+class StereoCircularBuffer
+{
+  float* data;
+  size_t size;
+  size_t mask;
+  // frame the next write goes into
+  size_t writeIndex;
+
+  StereoCircularBuffer(float* data, size_t size)
+    : data(data), size(size), mask(size - 1), writeIndex(0)
+  {
+  }
+
+public:
+  // in frames
+  size_t getSize() const
+  {
+    return size;
+  }
+
+  size_t getWriteIndex() const
+  {
+    return writeIndex;
+  }
+
+  void clear()
+  {
+    memset(data, 0, size * 2 * sizeof(float));
+  }
+
+  void write(const float* left, const float* right, size_t len)
+  {
+    while (len)
+    {
+      const size_t span = len < size - writeIndex ? len : size - writeIndex;
+      float* frame = data + writeIndex * 2;
+      for (size_t i = 0; i < span; ++i)
+      {
+        frame[i * 2] = left[i];
+        frame[i * 2 + 1] = right[i];
+      }
+      left += span;
+      right += span;
+      len -= span;
+      writeIndex = (writeIndex + span) & mask;
+    }
+  }
+
+  // reads back the last len frames written, with both channels delayed by a number of frames
+  // that moves linearly from beginDelay towards endDelay over the block.
+  void read(float* left, float* right, size_t len, float beginDelay, float endDelay) const
+  {
+    const float step = (endDelay - beginDelay) / len;
+    const size_t start = writeIndex - len;
+    for (size_t i = 0; i < len; ++i)
+    {
+      const float d = beginDelay + step * i;
+      const size_t di = (size_t)d;
+      const float t = d - di;
+      const float* a = data + ((start + i - di) & mask) * 2;
+      const float* b = data + ((start + i - di - 1) & mask) * 2;
+      left[i] = a[0] + t * (b[0] - a[0]);
+      right[i] = a[1] + t * (b[1] - a[1]);
+    }
+  }
+
+  // same as above with a separate delay ramp for each channel
+  void read(float* left, float* right, size_t len, float leftBegin, float leftEnd, float rightBegin, float rightEnd) const
+  {
+    const float leftStep = (leftEnd - leftBegin) / len;
+    const float rightStep = (rightEnd - rightBegin) / len;
+    const size_t start = writeIndex - len;
+    for (size_t i = 0; i < len; ++i)
+    {
+      left[i] = readLane(0, start + i, leftBegin + leftStep * i);
+      right[i] = readLane(1, start + i, rightBegin + rightStep * i);
+    }
+  }
+
+  // reads back the last len frames written with a delay for every sample of each channel
+  void read(float* left, float* right, size_t len, const float* leftDelay, const float* rightDelay) const
+  {
+    const size_t start = writeIndex - len;
+    for (size_t i = 0; i < len; ++i)
+    {
+      left[i] = readLane(0, start + i, leftDelay[i]);
+      right[i] = readLane(1, start + i, rightDelay[i]);
+    }
+  }
+
+  // plain reads of len frames starting at a frame index for each channel, as used when looping a frozen buffer
+  void readFrames(float* left, float* right, size_t leftIndex, size_t rightIndex, size_t len) const
+  {
+    if (leftIndex == rightIndex)
+    {
+      for (size_t i = 0; i < len; ++i)
+      {
+        const float* frame = data + ((leftIndex + i) & mask) * 2;
+        left[i] = frame[0];
+        right[i] = frame[1];
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < len; ++i)
+      {
+        left[i] = data[((leftIndex + i) & mask) * 2];
+        right[i] = data[((rightIndex + i) & mask) * 2 + 1];
+      }
+    }
+  }
+
+  // a buffer of at least this many frames
+  static StereoCircularBuffer* create(size_t frames)
+  {
+    size_t size = 1;
+    while (size < frames)
+    {
+      size <<= 1;
+    }
+    StereoCircularBuffer* buffer = new StereoCircularBuffer(new float[size * 2], size);
+    buffer->clear();
+    return buffer;
+  }
+
+  static void destroy(StereoCircularBuffer* buffer)
+  {
+    delete[] buffer->data;
+    delete buffer;
+  }
+
+private:
+  // interpolated read of one channel at a delay behind the frame at index
+  float readLane(int channel, size_t index, float delay) const
+  {
+    const size_t di = (size_t)delay;
+    const float t = delay - di;
+    const float a = data[((index - di) & mask) * 2 + channel];
+    const float b = data[((index - di - 1) & mask) * 2 + channel];
+    return a + t * (b - a);
+  }
+};
+
+#endif // __STEREO_CIRCULAR_BUFFER_H__
@@ -3,6 +3,7 @@
 
 #include "Patch.h" // for LEFT_CHANNEL and RIGHT_CHANNEL
 #include "Delay.h"
+#include "StereoCircularBuffer.h"
 //#include "DelayProcessor.h"
 //#include "DelayFreezeProcessor.h"
 
@@ -43,6 +44,13 @@ public:
     delays[1]->process(input.getSamples(RIGHT_CHANNEL), output.getSamples(RIGHT_CHANNEL));
   }
 
+  // per sample delay times for each channel, see DelayProcessor::processModulated
+  void processModulated(AudioBuffer& input, AudioBuffer& output, FloatArray leftDelayTimes, FloatArray rightDelayTimes)
+  {
+    delays[0]->processModulated(input.getSamples(LEFT_CHANNEL), output.getSamples(LEFT_CHANNEL), leftDelayTimes);
+    delays[1]->processModulated(input.getSamples(RIGHT_CHANNEL), output.getSamples(RIGHT_CHANNEL), rightDelayTimes);
+  }
+
   static StereoDelayProcessor* create(size_t delayLength, size_t blockSize)
   {
     return new StereoDelayProcessor(DelayType::create(delayLength, blockSize), DelayType::create(delayLength, blockSize));
@@ -105,4 +113,181 @@ public:
 
 };
 
+// Stereo delay with both channels in one interleaved buffer, see StereoCircularBuffer.
+// Delays are in samples and should be no longer than the delay length it was created with.
+class InterleavedStereoDelayProcessor : public MultiSignalProcessor
+{
+protected:
+  StereoCircularBuffer* buffer;
+  float delaySamples[2];
+  // delay each channel had at the end of the last block, which the next block ramps from
+  float blockDelay[2];
+
+public:
+  InterleavedStereoDelayProcessor(StereoCircularBuffer* buffer) : buffer(buffer)
+  {
+    delaySamples[0] = delaySamples[1] = 0;
+    blockDelay[0] = blockDelay[1] = 0;
+  }
+
+  float getDelay(PatchChannelId channel = LEFT_CHANNEL) const
+  {
+    return delaySamples[channel];
+  }
+
+  void setDelay(PatchChannelId channel, float samples)
+  {
+    delaySamples[channel] = samples;
+  }
+
+  void setDelay(float leftSamples, float rightSamples)
+  {
+    delaySamples[0] = leftSamples;
+    delaySamples[1] = rightSamples;
+  }
+
+  void clear()
+  {
+    buffer->clear();
+  }
+
+  void process(AudioBuffer& input, AudioBuffer& output) override
+  {
+    const size_t len = input.getSize();
+    buffer->write(input.getSamples(LEFT_CHANNEL), input.getSamples(RIGHT_CHANNEL), len);
+    float* left = output.getSamples(LEFT_CHANNEL);
+    float* right = output.getSamples(RIGHT_CHANNEL);
+    if (blockDelay[0] == blockDelay[1] && delaySamples[0] == delaySamples[1])
+    {
+      buffer->read(left, right, len, blockDelay[0], delaySamples[0]);
+    }
+    else
+    {
+      buffer->read(left, right, len, blockDelay[0], delaySamples[0], blockDelay[1], delaySamples[1]);
+    }
+    blockDelay[0] = delaySamples[0];
+    blockDelay[1] = delaySamples[1];
+  }
+
+  // per sample delay times for each channel, the last ones become the delays for process
+  void processModulated(AudioBuffer& input, AudioBuffer& output, FloatArray leftDelayTimes, FloatArray rightDelayTimes)
+  {
+    const size_t len = input.getSize();
+    buffer->write(input.getSamples(LEFT_CHANNEL), input.getSamples(RIGHT_CHANNEL), len);
+    buffer->read(output.getSamples(LEFT_CHANNEL), output.getSamples(RIGHT_CHANNEL), len, leftDelayTimes, rightDelayTimes);
+    setDelay(leftDelayTimes[len - 1], rightDelayTimes[len - 1]);
+    blockDelay[0] = delaySamples[0];
+    blockDelay[1] = delaySamples[1];
+  }
+
+  static InterleavedStereoDelayProcessor* create(size_t delayLength, size_t blockSize)
+  {
+    return new InterleavedStereoDelayProcessor(StereoCircularBuffer::create(delayLength + blockSize + 1));
+  }
+
+  static void destroy(InterleavedStereoDelayProcessor* obj)
+  {
+    StereoCircularBuffer::destroy(obj->buffer);
+    delete obj;
+  }
+};
+
+// Freezing works like DelayWithFreezeProcessor, except that both channels loop over the left delay
+// so that their restarts and fades line up and are worked out once for the pair.
+class InterleavedStereoDelayWithFreezeProcessor : public InterleavedStereoDelayProcessor
+{
+  bool freeze;
+  // frames left to read before the frozen loop restarts, out of loopLength
+  int freezeRead;
+  int loopLength;
+  float pos[2];
+  size_t readIndex[2];
+  FadeRamp* fade;
+  int blockSize;
+
+public:
+  InterleavedStereoDelayWithFreezeProcessor(StereoCircularBuffer* buffer, FadeRamp* fade, int blockSize)
+    : InterleavedStereoDelayProcessor(buffer), freeze(false), freezeRead(0), loopLength(0), fade(fade), blockSize(blockSize)
+  {
+    pos[0] = pos[1] = 0;
+  }
+
+  void setFreeze(bool enabled)
+  {
+    freeze = enabled;
+    freezeRead = 0;
+  }
+
+  void setPosition(float position)
+  {
+    pos[0] = pos[1] = position;
+  }
+
+  void setPosition(float leftPosition, float rightPosition)
+  {
+    pos[0] = leftPosition;
+    pos[1] = rightPosition;
+  }
+
+  float getPosition() const
+  {
+    return pos[0];
+  }
+
+  void setEqualPowerFade(bool enabled)
+  {
+    fade->setEqualPower(enabled);
+  }
+
+  void process(AudioBuffer& input, AudioBuffer& output) override
+  {
+    if (!freeze)
+    {
+      InterleavedStereoDelayProcessor::process(input, output);
+      return;
+    }
+
+    float* left = output.getSamples(LEFT_CHANNEL);
+    float* right = output.getSamples(RIGHT_CHANNEL);
+    int readSz = output.getSize();
+    while (readSz)
+    {
+      if (freezeRead <= 0)
+      {
+        const size_t writeIndex = buffer->getWriteIndex();
+        readIndex[0] = writeIndex - (size_t)(delaySamples[0] + pos[0]);
+        readIndex[1] = writeIndex - (size_t)(delaySamples[1] + pos[1]);
+        // at least a frame, or a delay under one sample would never read anything and this would never finish
+        loopLength = freezeRead = max((int)delaySamples[0], 1);
+        fade->setLength(min((float)blockSize, max(delaySamples[0] / 8, 1.0f)));
+        continue;
+      }
+      const int len = freezeRead < readSz ? freezeRead : readSz;
+      buffer->readFrames(left, right, readIndex[0], readIndex[1], len);
+      const size_t loopPos = loopLength - freezeRead;
+      fade->applyWindow(left, loopPos, len, loopLength);
+      fade->applyWindow(right, loopPos, len, loopLength);
+      readIndex[0] += len;
+      readIndex[1] += len;
+      left += len;
+      right += len;
+      readSz -= len;
+      freezeRead -= len;
+    }
+  }
+
+  static InterleavedStereoDelayWithFreezeProcessor* create(size_t delayLength, size_t blockSize)
+  {
+    return new InterleavedStereoDelayWithFreezeProcessor(StereoCircularBuffer::create(delayLength + blockSize + 1),
+                                                         FadeRamp::create(blockSize, blockSize), blockSize);
+  }
+
+  static void destroy(InterleavedStereoDelayWithFreezeProcessor* obj)
+  {
+    FadeRamp::destroy(obj->fade);
+    StereoCircularBuffer::destroy(obj->buffer);
+    delete obj;
+  }
+};
+
 #endif // __STEREO_DELAY_PROCESSOR_H__